@@ -5,7 +5,9 @@
 // leaves the recovered clock at a variable bit offset from the event
 // generator reference clock.  Instead the transceiver is reset until it
 // starts up with correct framing.  This has a 99.9% chance of happening
-// within 135 attempts ((19/20)^135=0.983e-3).
+// within 135 attempts ((19/20)^135=0.983e-3).  Resetting just the receiver
+// datapath is enough to pick a new framing and avoids waiting for the
+// CPLL to relock on each attempt.
 
 module evrGTYwrapper #(
     parameter DEBUG = "false"
@@ -65,6 +67,7 @@ drpControl #(.DRP_DATA_WIDTH(DRP_DATA_WIDTH),
 //////////////////////////////////////////////////////////////////////////////
 // Reset and bit slide control
 reg reset_all = 0;
+reg reset_rx_datapath = 0;
 reg gtwiz_userclk_tx_reset = 0;
 reg sysBuffBypassTxResetToggle = 0;
 reg sysBuffBypassTxStartToggle = 0;
@@ -72,6 +75,7 @@ reg sysSlideRequestToggle = 0;
 always @(posedge sysClk) begin
     if (csrStrobe) begin
         reset_all <= GPIO_OUT[0];
+        reset_rx_datapath <= GPIO_OUT[4];
         gtwiz_userclk_tx_reset <= GPIO_OUT[1];
         if (GPIO_OUT[2]) begin
             sysBuffBypassTxResetToggle <= !sysBuffBypassTxResetToggle;
@@ -168,7 +172,8 @@ end
 wire reset_rx_done, reset_tx_done, cplllocked;
 wire gtwiz_buffbypass_tx_done, gtwiz_buffbypass_tx_error;
 assign csr = { badKcount, badCharCount,
-               {32-FAULT_COUNTER_WIDTH-FAULT_COUNTER_WIDTH-8{1'b0}},
+               {32-FAULT_COUNTER_WIDTH-FAULT_COUNTER_WIDTH-9{1'b0}},
+               reset_rx_datapath,
                evrRxSynchronized, reset_tx_done,
                reset_rx_done, cplllocked,
                gtwiz_buffbypass_tx_error, gtwiz_buffbypass_tx_done,
@@ -201,7 +206,7 @@ assign csr = { badKcount, badCharCount,
     .gtwiz_reset_tx_pll_and_datapath_in(1'b0),   // input wire [0 : 0] gtwiz_reset_tx_pll_and_datapath_in
     .gtwiz_reset_tx_datapath_in(1'b0),           // input wire [0 : 0] gtwiz_reset_tx_datapath_in
     .gtwiz_reset_rx_pll_and_datapath_in(1'b0),   // input wire [0 : 0] gtwiz_reset_rx_pll_and_datapath_in
-    .gtwiz_reset_rx_datapath_in(1'b0),           // input wire [0 : 0] gtwiz_reset_rx_datapath_in
+    .gtwiz_reset_rx_datapath_in(reset_rx_datapath), // input wire [0 : 0] gtwiz_reset_rx_datapath_in
     .gtwiz_reset_rx_cdr_stable_out(),            // output wire [0 : 0] gtwiz_reset_rx_cdr_stable_out
     .gtwiz_reset_tx_done_out(reset_tx_done),     // output wire [0 : 0] gtwiz_reset_tx_done_out
     .gtwiz_reset_rx_done_out(reset_rx_done),     // output wire [0 : 0] gtwiz_reset_rx_done_out
@@ -1,4 +1,18 @@
 // Log event arrival
+//
+// Events whose filter bit is set are not logged.
+// Raw mode stores one {event, ticks} pair per buffer word.
+// Compressed mode stores two 20-bit {event, delta} entries per buffer word,
+// with the delta in EVR clocks since the previous logged event:
+//   {event, delta[11:0]}       -- event arrived, delta < 4096
+//   {8'h00, delta[23:12]}      -- upper bits of delta for following event
+//   {8'h00, 12'h000}           -- 2^24 clocks passed with no event
+// Entry 2n is in bits 19:0 and entry 2n+1 in bits 39:20 of buffer word n.
+// The overflow flag is set, and remains set until logging stops, if an
+// entry is written when the buffer holds as many unread entries as the
+// readout can distinguish from an empty buffer.  Unread entries are
+// counted from the start of the word at the most recent read address.
+// Decoder is eventLoggerDecode() in software/src/eventLoggerDecode.c.
 module evrLogger #(
     parameter ADDR_WIDTH = 10
     ) (
@@ -7,46 +21,161 @@ module evrLogger #(
     input  wire [31:0] sysGpioOut,
     output wire [31:0] sysCsr,
     output wire [31:0] sysDataTicks,
-    
+
     input  wire        evrClk,
     input  wire  [7:0] evrChar,
     input  wire        evrCharIsK);
 
-reg [ADDR_WIDTH-1:0] sysReadAddress = 0, evrWriteAddress = 0;
-reg sysRunning = 0;
+localparam ENTRY_WIDTH = 20;
+localparam DELTA_WIDTH = ENTRY_WIDTH - 8;
+
+// Write address counts entries, so is one bit wider than the buffer address
+reg [ADDR_WIDTH-1:0] sysReadAddress = 0;
+reg [ADDR_WIDTH:0] evrWriteAddress = 0;
+reg sysRunning = 0, sysCompress = 0;
+reg sysReadToggle = 0;
+(*ASYNC_REG="true"*) reg sysOverflow_m = 0;
+reg sysOverflow = 0, evrOverflow = 0;
 wire [3:0] addrWidth = ADDR_WIDTH;
-reg [39:0] dpram[0:(1<<ADDR_WIDTH)-1], dpramQ;
+reg [ENTRY_WIDTH-1:0] dpramLo[0:(1<<ADDR_WIDTH)-1];
+reg [ENTRY_WIDTH-1:0] dpramHi[0:(1<<ADDR_WIDTH)-1];
+reg [39:0] dpramQ;
+reg filter[0:255];
 wire [7:0] sysDataEvent = dpramQ[39:32];
 assign sysDataTicks = dpramQ[31:0];
-assign sysCsr = { sysRunning, {3{1'b0}}, addrWidth,
+assign sysCsr = { sysRunning, sysCompress, sysOverflow, 1'b0, addrWidth,
                   sysDataEvent,
-                  {16-ADDR_WIDTH{1'b0}}, evrWriteAddress };
+                  {16-ADDR_WIDTH-1{1'b0}}, evrWriteAddress };
+
+integer i;
+initial begin
+    for (i = 0 ; i < 256 ; i = i + 1) filter[i] = 0;
+end
+
+// Filter updates leave the run state and read address unchanged
 always @(posedge sysClk) begin
     if (sysCsrStrobe) begin
-        sysReadAddress <= sysGpioOut[ADDR_WIDTH-1:0];
-        sysRunning <= sysGpioOut[31];
+        if (sysGpioOut[30]) begin
+            filter[sysGpioOut[7:0]] <= sysGpioOut[8];
+        end
+        else begin
+            sysReadAddress <= sysGpioOut[ADDR_WIDTH-1:0];
+            sysReadToggle <= !sysReadToggle;
+            sysRunning <= sysGpioOut[31];
+            sysCompress <= sysGpioOut[29];
+        end
     end
-    dpramQ <= dpram[sysReadAddress];
+    dpramQ <= { dpramHi[sysReadAddress], dpramLo[sysReadAddress] };
+    sysOverflow_m <= evrOverflow;
+    sysOverflow   <= sysOverflow_m;
 end
 
-(*ASYNC_REG="true"*) reg evrRunning_m;
-reg        evrRunning;
-reg        evrDPRAMwen;
-reg  [7:0] evrDPRAMevent;
+(*ASYNC_REG="true"*) reg evrRunning_m, evrCompress_m;
+reg        evrRunning, evrCompress;
+reg        evrLogEvent;
+reg  [7:0] evrLogChar;
 reg [31:0] evrTickCounter = 0;
+reg [23:0] evrSinceLast = 0;
+reg  [1:0] evrEntryCount = 0;
+reg [ENTRY_WIDTH-1:0] evrEntryA, evrEntryB;
 always @(posedge evrClk) begin
     evrRunning_m <= sysRunning;
     evrRunning   <= evrRunning_m;
+    evrCompress_m <= sysCompress;
+    evrCompress   <= evrCompress_m;
     evrTickCounter <= evrTickCounter + 1;
-    evrDPRAMwen <= evrRunning && !evrCharIsK && (evrChar != 0);
-    evrDPRAMevent <= evrChar;
-    if (evrDPRAMwen) begin
-        dpram[evrWriteAddress] <= { evrDPRAMevent, evrTickCounter };
-        evrWriteAddress <= evrWriteAddress + 1;
+    evrLogEvent <= evrRunning && !evrCharIsK && (evrChar != 0)
+                                              && !filter[evrChar];
+    evrLogChar <= evrChar;
+
+    // Form the zero, one or two entries to be written
+    if (!evrRunning) begin
+        evrSinceLast <= 0;
+        evrEntryCount <= 0;
     end
-    else if (!evrRunning) begin
+    else if (evrLogEvent) begin
+        evrSinceLast <= 1;
+        if (!evrCompress) begin
+            { evrEntryB, evrEntryA } <= { evrLogChar, evrTickCounter };
+            evrEntryCount <= 1;
+        end
+        else if (evrSinceLast[23:DELTA_WIDTH] == 0) begin
+            evrEntryA <= { evrLogChar, evrSinceLast[DELTA_WIDTH-1:0] };
+            evrEntryCount <= 1;
+        end
+        else begin
+            evrEntryA <= { 8'h00, evrSinceLast[23:DELTA_WIDTH] };
+            evrEntryB <= { evrLogChar, evrSinceLast[DELTA_WIDTH-1:0] };
+            evrEntryCount <= 2;
+        end
+    end
+    else if (evrCompress && (evrSinceLast == {24{1'b1}})) begin
+        evrSinceLast <= 0;
+        evrEntryA <= 0;
+        evrEntryCount <= 1;
+    end
+    else begin
+        evrSinceLast <= evrSinceLast + 1;
+        evrEntryCount <= 0;
+    end
+end
+
+// Read address is stable by the time the toggle has been synchronized
+(*ASYNC_REG="true"*) reg evrReadToggle_m = 0;
+reg evrReadToggle = 0, evrReadToggle_d = 0;
+reg [ADDR_WIDTH-1:0] evrReadAddress = 0;
+always @(posedge evrClk) begin
+    evrReadToggle_m <= sysReadToggle;
+    evrReadToggle   <= evrReadToggle_m;
+    evrReadToggle_d <= evrReadToggle;
+    if (evrReadToggle != evrReadToggle_d) begin
+        evrReadAddress <= sysReadAddress;
+    end
+end
+
+// Unread entries and the most the readout can distinguish
+wire [ADDR_WIDTH:0] evrUnread = evrCompress ?
+                evrWriteAddress - { evrReadAddress, 1'b0 } :
+                { 1'b0, evrWriteAddress[ADDR_WIDTH-1:0] - evrReadAddress };
+wire [ADDR_WIDTH:0] evrUnreadLimit = evrCompress ? {ADDR_WIDTH+1{1'b1}} :
+                                                   {1'b0, {ADDR_WIDTH{1'b1}}};
+
+// Consecutive entries are in different halves so both can be written at once
+wire [ADDR_WIDTH:0] evrWriteAddressNext = evrWriteAddress + 1;
+wire evrWriteOdd = evrCompress && evrWriteAddress[0];
+wire [ADDR_WIDTH-1:0] evrWordAddress = evrCompress ?
+                                   evrWriteAddress[ADDR_WIDTH:1] :
+                                   evrWriteAddress[ADDR_WIDTH-1:0];
+wire [ADDR_WIDTH-1:0] evrWordAddressNext = evrWriteAddressNext[ADDR_WIDTH:1];
+wire evrLoWen = evrCompress ? (evrWriteOdd ? (evrEntryCount == 2) :
+                                             (evrEntryCount != 0)) :
+                              (evrEntryCount != 0);
+wire evrHiWen = evrCompress ? (evrWriteOdd ? (evrEntryCount != 0) :
+                                             (evrEntryCount == 2)) :
+                              (evrEntryCount != 0);
+always @(posedge evrClk) begin
+    if (evrLoWen) begin
+        dpramLo[evrWriteOdd ? evrWordAddressNext : evrWordAddress] <=
+                                        evrWriteOdd ? evrEntryB : evrEntryA;
+    end
+    if (evrHiWen) begin
+        dpramHi[evrWordAddress] <= evrWriteOdd ? evrEntryA : evrEntryB;
+    end
+    if (!evrRunning) begin
+        evrOverflow <= 0;
+    end
+    else if (({1'b0, evrUnread} + evrEntryCount) > {1'b0, evrUnreadLimit}) begin
+        evrOverflow <= 1;
+    end
+    if (!evrRunning) begin
         evrWriteAddress <= 0;
     end
+    else if (evrCompress) begin
+        evrWriteAddress <= evrWriteAddress + evrEntryCount;
+    end
+    else if (evrEntryCount != 0) begin
+        evrWriteAddress <= evrWriteAddressNext;
+    end
 end
 
 endmodule
@@ -0,0 +1,87 @@
+/*
+ * Check evrLogger_tb compressed mode buffer contents
+ * Decode the buffer with the firmware decoder and compare
+ * with the events the test bench sent.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "eventLogger.h"
+
+#define BUFFER_FILE "evrLogger_buffer.dat"
+#define EXPECT_FILE "evrLogger_expect.dat"
+
+static FILE *
+openFile(const char *name)
+{
+    FILE *fp = fopen(name, "r");
+    if (fp == NULL) {
+        perror(name);
+        exit(2);
+    }
+    return fp;
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *bufferFp = openFile(BUFFER_FILE);
+    FILE *expectFp = openFile(EXPECT_FILE);
+    struct eventLoggerDecoder decoder;
+    unsigned long long word = 0;
+    int entryCount, entryIndex;
+    int eventCount = 0, failed = 0;
+    uint32_t ticks, oldTicks = 0;
+    long expectCycle, oldExpectCycle = 0;
+    int expectCode;
+
+    if (fscanf(bufferFp, "%d", &entryCount) != 1) {
+        fprintf(stderr, "Bad %s\n", BUFFER_FILE);
+        return 2;
+    }
+    eventLoggerDecoderInit(&decoder);
+    for (entryIndex = 0 ; entryIndex < entryCount ; entryIndex++) {
+        uint32_t entry;
+        int eventCode;
+        if ((entryIndex % 2) == 0) {
+            if (fscanf(bufferFp, "%llx", &word) != 1) {
+                fprintf(stderr, "%s too short\n", BUFFER_FILE);
+                return 2;
+            }
+            entry = word & 0xFFFFF;
+        }
+        else {
+            entry = (word >> 20) & 0xFFFFF;
+        }
+        eventCode = eventLoggerDecode(&decoder, entry, &ticks);
+        if (eventCode == 0) continue;
+        if (fscanf(expectFp, "%d %ld", &expectCode, &expectCycle) != 2) {
+            printf("Unexpected event %d at entry %d   FAIL\n", eventCode,
+                                                               entryIndex);
+            failed = 1;
+            break;
+        }
+
+        /*
+         * Ticks count from start of capture so compare intervals
+         */
+        if ((eventCode != expectCode)
+         || ((eventCount != 0)
+          && ((ticks - oldTicks) != (uint32_t)(expectCycle - oldExpectCycle)))) {
+            printf("Event %d expect %d:%ld, got %d:%u   FAIL\n", eventCount,
+                                expectCode, expectCycle - oldExpectCycle,
+                                eventCode, (unsigned int)(ticks - oldTicks));
+            failed = 1;
+        }
+        oldTicks = ticks;
+        oldExpectCycle = expectCycle;
+        eventCount++;
+    }
+    if (fscanf(expectFp, "%d %ld", &expectCode, &expectCycle) == 2) {
+        printf("Event %d missing   FAIL\n", eventCount);
+        failed = 1;
+    }
+    printf("%d events from %d entries.\n", eventCount, entryCount);
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed;
+}
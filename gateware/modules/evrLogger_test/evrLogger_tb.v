@@ -0,0 +1,215 @@
+// Event logger test bench
+// Compressed mode buffer contents are written to evrLogger_buffer.dat and
+// the events that should have been logged to evrLogger_expect.dat.
+// evrLogger_check decodes the former with the firmware decoder and compares.
+// Raw mode is checked here.
+
+`timescale 1 ns / 1ns
+
+module evrLogger_tb;
+
+localparam ADDR_WIDTH = 7;
+
+localparam CSR_W_RUN           = 32'h80000000;
+localparam CSR_W_FILTER        = 32'h40000000;
+localparam CSR_W_COMPRESS      = 32'h20000000;
+localparam CSR_W_FILTER_IGNORE = 32'h00000100;
+localparam CSR_R_COMPRESSING   = 32'h40000000;
+
+localparam EVENT_IGNORED   = 8'd112;
+localparam EVENT_HEARTBEAT = 8'd122;
+
+reg sysClk = 1, evrClk = 1;
+reg sysCsrStrobe = 0;
+reg [31:0] sysGpioOut = {32{1'bx}};
+wire [31:0] sysCsr, sysDataTicks;
+reg [7:0] evrChar = 0;
+reg evrCharIsK = 0;
+
+always begin
+    #5 sysClk = !sysClk;
+end
+always begin
+    #4 evrClk = !evrClk;
+end
+
+evrLogger #(.ADDR_WIDTH(ADDR_WIDTH))
+  evrLogger (
+    .sysClk(sysClk),
+    .sysCsrStrobe(sysCsrStrobe),
+    .sysGpioOut(sysGpioOut),
+    .sysCsr(sysCsr),
+    .sysDataTicks(sysDataTicks),
+    .evrClk(evrClk),
+    .evrChar(evrChar),
+    .evrCharIsK(evrCharIsK));
+
+integer evrCycle = 0;
+always @(posedge evrClk) evrCycle <= evrCycle + 1;
+
+integer failed = 0;
+integer expectFile, bufferFile;
+integer i, gap;
+integer rawCount = 0;
+reg [7:0] rawCodes[0:15];
+integer rawCycles[0:15];
+
+initial begin
+    if ($test$plusargs("vcd")) begin
+        $dumpfile("evrLogger_tb.lxt");
+        $dumpvars(0, evrLogger_tb);
+    end
+    expectFile = $fopen("evrLogger_expect.dat", "w");
+    bufferFile = $fopen("evrLogger_buffer.dat", "w");
+
+    #40 ;
+    GPIO_WRITE(CSR_W_FILTER | CSR_W_FILTER_IGNORE | EVENT_IGNORED);
+    GPIO_WRITE(CSR_W_RUN | CSR_W_COMPRESS);
+    if ((sysCsr & CSR_R_COMPRESSING) == 0) begin
+        $display("Compression not enabled   FAIL");
+        failed = 1;
+    end
+    #100 ;
+
+    // Deltas at the limits of one, two and three entry encoding
+    sendEvent(1, 1);
+    sendEvent(1, 2);
+    sendEvent(4095, 3);
+    sendEvent(4096, 4);
+    sendEvent(1, 5);
+    sendEvent(4097, 6);
+    sendEvent(2, 7);
+    sendEvent(3, 8);
+    sendEvent((1 << 24) - 1, 9);
+    sendEvent(1, 10);
+    sendEvent((1 << 24) + 4100, 11);
+    sendEvent(1, 12);
+
+    // Ignored events and K characters in the gaps
+    for (i = 0 ; i < 60 ; i = i + 1) begin
+        case (i % 4)
+        0: gap = 1 + ({$random} % 8);
+        1: gap = 1 + ({$random} % 4000);
+        2: gap = 4000 + ({$random} % 100000);
+        3: gap = 50 + ({$random} % 200);
+        endcase
+        if (i % 3) sendEvent(gap, EVENT_HEARTBEAT);
+        else       sendEvent(gap, 1 + ({$random} % 255));
+    end
+    idle(100);
+    readBuffer;
+
+    // Raw mode
+    GPIO_WRITE(0);
+    #100 ;
+    GPIO_WRITE(CSR_W_RUN);
+    #100 ;
+    for (i = 0 ; i < 16 ; i = i + 1) begin
+        sendEvent(1 + ({$random} % 20000), 1 + (i * 11));
+    end
+    idle(100);
+    checkRaw;
+
+    $fclose(expectFile);
+    $fclose(bufferFile);
+    $display("%s", failed ? "FAIL" : "PASS");
+    $finish;
+end
+
+// Send an event the given number of EVR clocks after the previous event
+task sendEvent;
+    input integer delta;
+    input [7:0] code;
+    begin
+        idle(delta - 1);
+        @(posedge evrClk) begin
+            evrChar <= code;
+            evrCharIsK <= 0;
+        end
+        if (code == EVENT_IGNORED) begin
+        end
+        else if (evrLogger.evrCompress) begin
+            $fwrite(expectFile, "%0d %0d\n", code, evrCycle);
+        end
+        else begin
+            rawCodes[rawCount] = code;
+            rawCycles[rawCount] = evrCycle;
+            rawCount = rawCount + 1;
+        end
+    end
+endtask
+
+// Fill gaps with K characters and ignored events
+task idle;
+    input integer n;
+    integer c;
+    begin
+        for (c = 0 ; c < n ; c = c + 1) begin
+            @(posedge evrClk) begin
+                evrChar <= 0;
+                evrCharIsK <= 0;
+                if ((c % 1000) == 7) begin
+                    evrChar <= 8'hBC;
+                    evrCharIsK <= 1;
+                end
+                else if ((c % 1000) == 11) begin
+                    evrChar <= EVENT_IGNORED;
+                end
+            end
+        end
+    end
+endtask
+
+task readBuffer;
+    integer count, w;
+    begin
+        count = sysCsr[ADDR_WIDTH:0];
+        $fwrite(bufferFile, "%0d\n", count);
+        for (w = 0 ; w < ((count + 1) / 2) ; w = w + 1) begin
+            GPIO_WRITE(CSR_W_RUN | CSR_W_COMPRESS | w);
+            $fwrite(bufferFile, "%x\n", {sysCsr[23:16], sysDataTicks});
+        end
+    end
+endtask
+
+task checkRaw;
+    integer count, w;
+    reg [31:0] ticks0;
+    begin
+        count = sysCsr[ADDR_WIDTH-1:0];
+        if (count != rawCount) begin
+            $display("Raw mode expect %0d events, got %0d   FAIL", rawCount,
+                                                                     count);
+            failed = 1;
+        end
+        for (w = 0 ; w < count ; w = w + 1) begin
+            GPIO_WRITE(CSR_W_RUN | w);
+            if (w == 0) ticks0 = sysDataTicks;
+            if ((sysCsr[23:16] != rawCodes[w])
+             || ((sysDataTicks - ticks0) != (rawCycles[w] - rawCycles[0]))) begin
+                $display("Raw mode entry %0d expect %0d:%0d, got %0d:%0d   FAIL",
+                                    w, rawCodes[w], rawCycles[w] - rawCycles[0],
+                                    sysCsr[23:16], sysDataTicks - ticks0);
+                failed = 1;
+            end
+        end
+    end
+endtask
+
+task GPIO_WRITE;
+    input [31:0] value;
+    begin
+        @(posedge sysClk) begin
+            sysCsrStrobe <= 1;
+            sysGpioOut <= value;
+        end
+        @(posedge sysClk) begin
+            sysCsrStrobe <= 0;
+            sysGpioOut <= 32'bx;
+        end
+        @(posedge sysClk) ;
+        @(posedge sysClk) ;
+    end
+endtask
+
+endmodule
@@ -0,0 +1,20 @@
+/*
+ * Host-side register model for display driver benchmark
+ */
+#ifndef _GPIO_H_
+#define _GPIO_H_
+
+#include <stdint.h>
+
+#define GPIO_IDX_MICROSECONDS_SINCE_BOOT  1 // Microseconds since boot (R)
+#define GPIO_IDX_DISPLAY_CSR             10 // Display CSR (R/W)
+#define GPIO_IDX_DISPLAY_DATA            11 // Display I/O (R/W)
+
+uint32_t benchGpioRead(int idx);
+void benchGpioWrite(int idx, uint32_t value);
+
+#define GPIO_READ(i)    benchGpioRead(i)
+#define GPIO_WRITE(i,x) benchGpioWrite((i),(x))
+#define MICROSECONDS_SINCE_BOOT()   GPIO_READ(GPIO_IDX_MICROSECONDS_SINCE_BOOT)
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Host-side benchmark of ST7789V display driver text rendering.
+ * Links the driver against a model of the display registers that counts
+ * the words written to the display command FIFO.  The FIFO is assumed to
+ * drain instantly.
+ *
+ * Reports FIFO words and CPU time for a page like those drawn by sysmon.c:
+ *   full    -- page drawn on a cleared screen
+ *   same    -- page redrawn with no changes
+ *   values  -- page redrawn with new readings
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "gpio.h"
+#include "st7789v.h"
+
+#define DISPLAY_WIDTH   320
+#define DISPLAY_HEIGHT  240
+#define ITERATIONS      1000
+
+#define CSR_R_ADDR_WIDTH_SHIFT  19
+#define FIFO_ADDRESS_WIDTH      11
+
+static unsigned long fifoWords;
+
+uint32_t
+benchGpioRead(int idx)
+{
+    struct timespec ts;
+
+    switch (idx) {
+    case GPIO_IDX_MICROSECONDS_SINCE_BOOT:
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+    case GPIO_IDX_DISPLAY_CSR:
+        return (FIFO_ADDRESS_WIDTH << CSR_R_ADDR_WIDTH_SHIFT) |
+                                              ((1 << FIFO_ADDRESS_WIDTH) - 1);
+    }
+    return 0;
+}
+
+void
+benchGpioWrite(int idx, uint32_t value)
+{
+    if (idx == GPIO_IDX_DISPLAY_DATA) {
+        fifoWords++;
+    }
+}
+
+void
+microsecondSpin(unsigned int us)
+{}
+
+static void
+drawPage(int pass)
+{
+    int line, w = st7789vCharWidth, h = st7789vCharHeight;
+    char cbuf[32];
+    static const char *names[] = {
+        "VCCINT", "VCCINT_IO", "VCCAUX", "VCC1V2", "VCC1V8", "VADJ_FMC",
+        "MGTAVCC", "MGTAVTT", "MGTVCCAUX", "VCC3V3", "UTIL_1V8", "UTIL_3V3" };
+
+    st7789vSetCharacterRGB(ST7789V_WHITE, ST7789V_BLACK);
+    st7789vShowString(DISPLAY_WIDTH-8*w, 0, "V    A");
+    for (line = 0 ; line < sizeof names / sizeof names[0] ; line++) {
+        int l = strlen(names[line]);
+        int i;
+        for (i = 0 ; i < l ; i++) {
+            st7789vDrawChar(DISPLAY_WIDTH - ((12 + l - i) * w),
+                                               (line + 1) * h, names[line][i]);
+        }
+        snprintf(cbuf, sizeof cbuf, "%4.2f%5.2f", 0.85 + (line * 0.1),
+                                               0.5 + ((line + pass) * 0.01));
+        st7789vShowString(DISPLAY_WIDTH-10*w, (line + 1) * h, cbuf);
+    }
+    snprintf(cbuf, sizeof cbuf, "2024-01-01 00:00:%02d", pass % 60);
+    st7789vShowString(0, DISPLAY_HEIGHT - h, cbuf);
+}
+
+static void
+run(const char *name, int clearFirst, int changeValues)
+{
+    struct timespec start, stop;
+    unsigned long words = 0;
+    double us = 0;
+    int i;
+
+    for (i = 0 ; i < ITERATIONS ; i++) {
+        if (clearFirst) {
+            st7789vFlood(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT, ST7789V_BLUE);
+            st7789vFlood(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT, ST7789V_BLACK);
+            st7789vFlush(0);
+        }
+        fifoWords = 0;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+        drawPage(changeValues ? (i + 1) : 0);
+        st7789vFlush(0);
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stop);
+        words += fifoWords;
+        us += ((stop.tv_sec - start.tv_sec) * 1e6) +
+                                         ((stop.tv_nsec - start.tv_nsec) / 1e3);
+    }
+    printf("%8s: %8lu FIFO words %10.2f us CPU per refresh\n", name,
+                                     words / ITERATIONS, us / ITERATIONS);
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned int hits, misses;
+
+    st7789vInit();
+    run("full", 1, 0);
+    drawPage(0);
+    st7789vFlush(0);
+    run("same", 0, 0);
+    run("values", 0, 1);
+    st7789vGlyphCacheStats(&hits, &misses);
+    printf("Glyph cache: %u hits, %u misses\n", hits, misses);
+    return 0;
+}
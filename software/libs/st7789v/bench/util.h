@@ -0,0 +1,9 @@
+/*
+ * Host-side utility routines for display driver benchmark
+ */
+#ifndef _UTIL_H_
+#define _UTIL_H_
+
+void microsecondSpin(unsigned int us);
+
+#endif /* _UTIL_H_ */
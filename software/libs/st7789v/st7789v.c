@@ -33,6 +33,7 @@
  */
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include "gpio.h"
 #include "lv_font.h"
 #include "st7789v.h"
@@ -97,9 +98,104 @@
 #define READ_DATA()   GPIO_READ(GPIO_IDX_DISPLAY_DATA)
 #define WRITE_DATA(v)  GPIO_WRITE(GPIO_IDX_DISPLAY_DATA, (v))
 
+#define CHAR_WIDTH_MAX  16
+#define CHAR_HEIGHT_MAX 24
+#define CHAR_PIXELS_MAX (CHAR_WIDTH_MAX * CHAR_HEIGHT_MAX)
+
 extern const lv_font_t systemFont;
 int st7789vCharWidth, st7789vCharHeight;
 static int pixelsPerCharacter;
+static int fontIsUsable;
+
+/*
+ * Copy of display contents
+ * The drawing routines update this copy and note the changed span of each
+ * row.  Changes are sent to the display by st7789vFlush.  Screen grabs
+ * come from here rather than reading back from the controller.
+ */
+static uint16_t shadow[ROW_COUNT][COL_COUNT];
+static int16_t dirtyStart[ROW_COUNT], dirtyEnd[ROW_COUNT];
+static int isDirty;
+
+static void
+markDirty(int y, int xs, int xe)
+{
+    if (dirtyStart[y] >= dirtyEnd[y]) {
+        dirtyStart[y] = xs;
+        dirtyEnd[y] = xe;
+    }
+    else {
+        if (xs < dirtyStart[y]) dirtyStart[y] = xs;
+        if (xe > dirtyEnd[y]) dirtyEnd[y] = xe;
+    }
+    isDirty = 1;
+}
+
+static void
+markAllDirty(void)
+{
+    int y;
+
+    for (y = 0 ; y < ROW_COUNT ; y++) {
+        markDirty(y, 0, COL_COUNT);
+    }
+}
+
+/*
+ * Update copy, noting only pixels that actually change
+ */
+static void
+shadowFlood(int xs, int ys, int width, int height, uint16_t value)
+{
+    int x, y;
+    int xe = xs + width, ye = ys + height;
+
+    if (xs < 0) xs = 0;
+    if (ys < 0) ys = 0;
+    if (xe > COL_COUNT) xe = COL_COUNT;
+    if (ye > ROW_COUNT) ye = ROW_COUNT;
+    for (y = ys ; y < ye ; y++) {
+        int first = -1, last = -1;
+        uint16_t *sp = &shadow[y][xs];
+        for (x = xs ; x < xe ; x++, sp++) {
+            if (*sp != value) {
+                *sp = value;
+                if (first < 0) first = x;
+                last = x;
+            }
+        }
+        if (first >= 0) {
+            markDirty(y, first, last + 1);
+        }
+    }
+}
+
+static void
+shadowCopy(int xs, int ys, int width, int height, const uint16_t *data)
+{
+    int x, y;
+    int x0 = xs, y0 = ys, xe = xs + width, ye = ys + height;
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (xe > COL_COUNT) xe = COL_COUNT;
+    if (ye > ROW_COUNT) ye = ROW_COUNT;
+    for (y = y0 ; y < ye ; y++) {
+        int first = -1, last = -1;
+        const uint16_t *dp = data + ((y - ys) * width) + (x0 - xs);
+        uint16_t *sp = &shadow[y][x0];
+        for (x = x0 ; x < xe ; x++, sp++, dp++) {
+            if (*sp != *dp) {
+                *sp = *dp;
+                if (first < 0) first = x;
+                last = x;
+            }
+        }
+        if (first >= 0) {
+            markDirty(y, first, last + 1);
+        }
+    }
+}
 
 static void
 writeData(uint32_t value)
@@ -114,6 +210,14 @@ st7789vInit(void)
     st7789vCharWidth = systemFont.monospace,
     st7789vCharHeight = systemFont.h_px;
     pixelsPerCharacter = st7789vCharWidth * st7789vCharHeight;
+    if ((st7789vCharWidth > CHAR_WIDTH_MAX)
+     || (st7789vCharHeight > CHAR_HEIGHT_MAX)) {
+        printf("%dx%d characters -- text will be blank!\n", st7789vCharWidth,
+                                                          st7789vCharHeight);
+    }
+    else {
+        fontIsUsable = 1;
+    }
     WRITE_CSR(CSR_RESET | CSR_W_BACKLIGHT_DISABLE);
     microsecondSpin(100);
     WRITE_CSR(0);
@@ -127,6 +231,8 @@ st7789vInit(void)
     st7789vWriteRegister(CMD_WRDISBV, 0xFF);    /* Full brightness */
     st7789vWriteRegister(CMD_MADCTL, MADCTL_MY | MADCTL_MV);
     st7789vFlood(0, 0, COL_COUNT, ROW_COUNT, 0);
+    markAllDirty();
+    st7789vFlush(0);
     st7789vCommand(CMD_DISPON);
     st7789vAwaitCompletion();
     st7789vBacklightEnable(1);
@@ -137,9 +243,86 @@ st7789vAwaitCompletion(void)
 {
     int aw = (READ_CSR() & CSR_R_ADDR_WIDTH_MASK) >> CSR_R_ADDR_WIDTH_SHIFT;
     int capacity = (1 << aw) - 1;
+    st7789vFlush(0);
     while ((READ_CSR() & CSR_R_FREE_SPACE_MASK) < capacity) continue;
 }
 
+/*
+ * Send changed areas to the display.
+ * Return after the specified number of microseconds, or when the command
+ * FIFO has no room for another row, with the remaining changes left for
+ * a subsequent call.  A value of 0 waits until all changes have been sent.
+ * Rows with identical changed spans are sent as a single rectangle.
+ * Return non-zero if changes remain to be sent.
+ */
+int
+st7789vFlush(unsigned int microseconds)
+{
+    uint32_t then = MICROSECONDS_SINCE_BOOT();
+    int y = 0;
+
+    if (!isDirty) return 0;
+    for (;;) {
+        int xs, xe, w, h, nfree, r, i;
+        const uint16_t *p;
+
+        while ((y < ROW_COUNT) && (dirtyStart[y] >= dirtyEnd[y])) y++;
+        if (y >= ROW_COUNT) {
+            isDirty = 0;
+            return 0;
+        }
+        xs = dirtyStart[y];
+        xe = dirtyEnd[y];
+        w = xe - xs;
+        for (h = 1 ; (y + h) < ROW_COUNT ; h++) {
+            if ((dirtyStart[y + h] != xs) || (dirtyEnd[y + h] != xe)) break;
+        }
+
+        /*
+         * The command FIFO (2047 entries) always has room for one row
+         */
+        for (;;) {
+            nfree = READ_CSR() & CSR_R_FREE_SPACE_MASK;
+            if (nfree >= (w + 7)) break;
+            if (microseconds) return 1;
+        }
+        if (h > ((nfree - 7) / w)) h = (nfree - 7) / w;
+        WRITE_DATA(IO_BYTE | (CMD_CASET << 8));
+        WRITE_DATA(xs);
+        WRITE_DATA(IO_LAST | (xe - 1));
+        WRITE_DATA(IO_BYTE | (CMD_RASET << 8));
+        WRITE_DATA(y);
+        WRITE_DATA(IO_LAST | (y + h - 1));
+        WRITE_DATA(IO_BYTE | (CMD_RAMWR << 8));
+
+        /*
+         * Stop early, at the end of a row, if time has run out
+         */
+        for (r = 0 ; ; r++, y++) {
+            int isLast;
+            p = &shadow[y][xs];
+            i = w;
+            while (--i) {
+                WRITE_DATA(*p++);
+            }
+            dirtyEnd[y] = dirtyStart[y];
+            isLast = ((r + 1) >= h)
+                  || (microseconds
+                   && ((MICROSECONDS_SINCE_BOOT() - then) >= microseconds));
+            if (isLast) {
+                WRITE_DATA(IO_LAST | *p);
+                y++;
+                break;
+            }
+            WRITE_DATA(*p);
+        }
+        if (microseconds
+         && ((MICROSECONDS_SINCE_BOOT() - then) >= microseconds)) {
+            return 1;
+        }
+    }
+}
+
 void
 st7789vBacklightEnable(int enable)
 {
@@ -218,75 +401,13 @@ st7789vWriteRegister(int r, int v)
 void
 st7789vFlood(int xs, int ys, int width, int height, int value)
 {
-    int n = width * height;
-    int xe = xs + width - 1;
-    int ye = ys + height - 1;
-    int nfree = READ_CSR() & CSR_R_FREE_SPACE_MASK;
-
-    value &= 0xFFFF;
-    if (nfree >= (n + 7)) {
-        WRITE_DATA(IO_BYTE | (CMD_CASET << 8));
-        WRITE_DATA(xs & 0xFFFF);
-        WRITE_DATA(IO_LAST | (xe & 0xFFFF));
-        WRITE_DATA(IO_BYTE | (CMD_RASET << 8));
-        WRITE_DATA(ys & 0xFFFF);
-        WRITE_DATA(IO_LAST | (ye & 0xFFFF));
-        WRITE_DATA(IO_BYTE | (CMD_RAMWR << 8));
-        while (--n) {
-            WRITE_DATA(value);
-        }
-        WRITE_DATA(IO_LAST | value);
-    }
-    else {
-        writeData(IO_BYTE | (CMD_CASET << 8));
-        writeData(xs & 0xFFFF);
-        writeData(IO_LAST | (xe & 0xFFFF));
-        writeData(IO_BYTE | (CMD_RASET << 8));
-        writeData(ys & 0xFFFF);
-        writeData(IO_LAST | (ye & 0xFFFF));
-        writeData(IO_BYTE | (CMD_RAMWR << 8));
-        while (--n) {
-            writeData(value);
-        }
-        writeData(IO_LAST | value);
-    }
+    shadowFlood(xs, ys, width, height, value & 0xFFFF);
 }
 
 void
 st7789vDrawRectangle(int xs, int ys, int width, int height, const uint16_t *data)
 {
-    int n = width * height;
-    int xe = xs + width - 1;
-    int ye = ys + height - 1;
-    int nfree = READ_CSR() & CSR_R_FREE_SPACE_MASK;
-    const uint16_t *last = data + n - 1;
-
-    if (nfree >= (n + 7)) {
-        WRITE_DATA(IO_BYTE | (CMD_CASET << 8));
-        WRITE_DATA(xs & 0xFFFF);
-        WRITE_DATA(IO_LAST | ( xe & 0xFFFF));
-        WRITE_DATA(IO_BYTE | (CMD_RASET << 8));
-        WRITE_DATA(ys & 0xFFFF);
-        WRITE_DATA(IO_LAST | (ye & 0xFFFF));
-        WRITE_DATA(IO_BYTE | (CMD_RAMWR << 8));
-        while (data != last) {
-            WRITE_DATA(*data++);
-        }
-        WRITE_DATA(IO_LAST | *data);
-    }
-    else {
-        writeData(IO_BYTE | (CMD_CASET << 8));
-        writeData(xs & 0xFFFF);
-        writeData(IO_LAST | ( xe & 0xFFFF));
-        writeData(IO_BYTE | (CMD_RASET << 8));
-        writeData(ys & 0xFFFF);
-        writeData(IO_LAST | (ye & 0xFFFF));
-        writeData(IO_BYTE | (CMD_RAMWR << 8));
-        while (data != last) {
-            writeData(*data++);
-        }
-        writeData(IO_LAST | *data);
-    }
+    shadowCopy(xs, ys, width, height, data);
 }
 
 int
@@ -295,6 +416,7 @@ st7789vColorAtPixel(int x, int y)
     uint32_t v;
     x &= 0xFFFF;
     y &= 0xFFFF;
+    st7789vFlush(0);
     /* Must read back in 18 bit per pixel mode */
     st7789vWriteRegister(CMD_COLMOD, 0x66);
     writeData(IO_BYTE | (CMD_CASET << 8));
@@ -330,18 +452,18 @@ st7789vTestPattern(void)
  */
 #define FONT_MAX_BPP 4
 static uint16_t intensities[1<<FONT_MAX_BPP];
+static int charForeground, charBackground;
 void
 st7789vSetCharacterRGB(int foreground, int background)
 {
     int charForegroundComponent[3], charBackgroundComponent[3];
     int mask = (1 << systemFont.bpp) - 1;
     int intensity;
-    static int oldForeground, oldBackground;
-    if ((foreground == oldForeground) && (background == oldBackground)) {
+    if ((foreground == charForeground) && (background == charBackground)) {
         return;
     }
-    oldForeground = foreground;
-    oldBackground = background;
+    charForeground = foreground;
+    charBackground = background;
     if (systemFont.bpp > FONT_MAX_BPP) {
         printf("%d bits per pixel!\n", systemFont.bpp);
     }
@@ -365,104 +487,150 @@ st7789vSetCharacterRGB(int foreground, int background)
 }
 
 /*
- * Draw a character with left upper corner at (x, y)
+ * Expand a character to pixel values in the current colours
  */
-void
-st7789vDrawChar(int x, int y, int c)
+static void
+expandChar(int c, uint16_t *pixels)
 {
     int mask = (1 << systemFont.bpp) - 1;
-    int rowsRemaining, width, leftPad, rightPad;
-    int i, shift, intensity;
+    int row, col, width, leftPad, shift;
     const lv_font_glyph_dsc_t *dsc;
     const uint8_t *glyph;
-    if ((c < systemFont.unicode_first)
-    || (c > systemFont.unicode_last)
-    || ((dsc = &systemFont.glyph_dsc[c-systemFont.unicode_first])->w_px == 0)) {
-        glyph = NULL;
-    }
-    else {
-        width = dsc->w_px;
-        glyph = systemFont.glyph_bitmap + dsc->glyph_index;
-        leftPad = (systemFont.monospace - width) / 2;
-        rightPad = systemFont.monospace - (leftPad + width);
-    }
-
-    /*
-     * Set display range
-     */
-    while ((READ_CSR() & CSR_R_FREE_SPACE_MASK) < (pixelsPerCharacter+7)) {
-        continue;
-    }
-    WRITE_DATA(IO_BYTE | (CMD_CASET << 8));
-    WRITE_DATA(x & 0xFFFF);
-    WRITE_DATA(IO_LAST | ((x + systemFont.monospace - 1) & 0xFFFF));
-    WRITE_DATA(IO_BYTE | (CMD_RASET << 8));
-    WRITE_DATA(y & 0xFFFF);
-    WRITE_DATA(IO_LAST | ((y + systemFont.h_px - 1) & 0xFFFF));
-    WRITE_DATA(IO_BYTE | (CMD_RAMWR << 8));
 
     /*
      * Handle non-printable
      */
-    if (glyph == NULL) {
-        i = pixelsPerCharacter;
+    if ((c < systemFont.unicode_first)
+    || (c > systemFont.unicode_last)
+    || ((dsc = &systemFont.glyph_dsc[c-systemFont.unicode_first])->w_px == 0)) {
+        int i = pixelsPerCharacter;
         while (--i >= 0) {
-            WRITE_DATA(intensities[0]);
+            *pixels++ = intensities[0];
         }
-        WRITE_DATA(IO_LAST | intensities[0]);
         return;
     }
-    rowsRemaining = systemFont.h_px;
-    for (;;) {
+    width = dsc->w_px;
+    glyph = systemFont.glyph_bitmap + dsc->glyph_index;
+    leftPad = (systemFont.monospace - width) / 2;
+    for (row = 0 ; row < systemFont.h_px ; row++) {
         shift = 8 - systemFont.bpp;
-        i = leftPad;
-        while (--i >= 0) {
-            WRITE_DATA(intensities[0]);
-        }
-        i = width;
-        for (;;) {
-            intensity = intensities[(*glyph >> shift) & mask];
-            if (--i <= 0) {
-                break;
-            }
-            WRITE_DATA(intensity);
-            shift -= systemFont.bpp;
-            if (shift < 0) {
-                glyph++;
-                shift = 8 - systemFont.bpp;
-            }
-        }
-        if (--rowsRemaining == 0) {
-            if (rightPad == 0) {
-                WRITE_DATA(IO_LAST | intensity);
+        for (col = 0 ; col < systemFont.monospace ; col++) {
+            if ((col < leftPad) || (col >= (leftPad + width))) {
+                *pixels++ = intensities[0];
             }
             else {
-                WRITE_DATA(intensity);
-                i = rightPad;
-                while (--i > 0) {
-                    WRITE_DATA(intensities[0]);
+                *pixels++ = intensities[(*glyph >> shift) & mask];
+                shift -= systemFont.bpp;
+                if (shift < 0) {
+                    glyph++;
+                    shift = 8 - systemFont.bpp;
                 }
-                WRITE_DATA(IO_LAST | intensities[0]);
             }
-            return;
         }
-        WRITE_DATA(intensity);
-        i = rightPad;
-        while (--i >= 0) {
-            WRITE_DATA(intensities[0]);
+        /* Rows start on a byte boundary */
+        if (shift != (8 - systemFont.bpp)) {
+            glyph++;
         }
-        glyph++;
     }
 }
 
+/*
+ * Cache of expanded characters
+ * Direct mapped, keyed by character and colours.
+ */
+#define GLYPH_CACHE_SIZE 128
+static struct glyphCacheEntry {
+    int      c;
+    int      foreground;
+    int      background;
+    uint16_t pixels[CHAR_PIXELS_MAX];
+} glyphCache[GLYPH_CACHE_SIZE];
+static unsigned int glyphCacheHits, glyphCacheMisses;
+
+static const uint16_t *
+glyphPixels(int c)
+{
+    unsigned int h = ((unsigned int)c + ((charForeground ^ charBackground) * 97))
+                                                            % GLYPH_CACHE_SIZE;
+    struct glyphCacheEntry *gp = &glyphCache[h];
+
+    /* Entries start out with c == 0, which is never drawn */
+    if ((gp->c != c) || (c == 0)
+     || (gp->foreground != charForeground)
+     || (gp->background != charBackground)) {
+        expandChar(c, gp->pixels);
+        gp->c = c;
+        gp->foreground = charForeground;
+        gp->background = charBackground;
+        glyphCacheMisses++;
+    }
+    else {
+        glyphCacheHits++;
+    }
+    return gp->pixels;
+}
+
+void
+st7789vGlyphCacheStats(unsigned int *hits, unsigned int *misses)
+{
+    *hits = glyphCacheHits;
+    *misses = glyphCacheMisses;
+}
+
+/*
+ * Draw a character with left upper corner at (x, y)
+ * Characters too large for the glyph cache are drawn as background.
+ */
+void
+st7789vDrawChar(int x, int y, int c)
+{
+    if (!fontIsUsable) {
+        st7789vFlood(x, y, systemFont.monospace, systemFont.h_px,
+                                                            charBackground);
+        return;
+    }
+    st7789vDrawRectangle(x, y, systemFont.monospace, systemFont.h_px,
+                                                               glyphPixels(c));
+}
+
+/*
+ * Draw a sequence of characters as a single rectangle
+ */
+static void
+drawChars(int x, int y, const char *str, int n)
+{
+    static uint16_t pixels[COL_COUNT * CHAR_HEIGHT_MAX];
+    int w = systemFont.monospace;
+    int rowWidth, i, r;
+
+    if (n > (COL_COUNT / w)) n = COL_COUNT / w;
+    if (n <= 0) return;
+    rowWidth = n * w;
+    if (!fontIsUsable) {
+        st7789vFlood(x, y, rowWidth, systemFont.h_px, charBackground);
+        return;
+    }
+    for (i = 0 ; i < n ; i++) {
+        const uint16_t *gp = glyphPixels((unsigned char)str[i]);
+        uint16_t *dp = pixels + (i * w);
+        for (r = 0 ; r < systemFont.h_px ; r++) {
+            memcpy(dp, gp, w * sizeof *dp);
+            gp += w;
+            dp += rowWidth;
+        }
+    }
+    st7789vDrawRectangle(x, y, rowWidth, systemFont.h_px, pixels);
+}
+
 void
 st7789vShowString(int xBase, int yBase, const char *str)
 {
-    while (*str && (xBase <= (COL_COUNT - st7789vCharWidth))) {
-        st7789vDrawChar(xBase, yBase, *str);
-        str++;
-        xBase += st7789vCharWidth;
+    int n = 0;
+
+    while (str[n] && (xBase + ((n + 1) * st7789vCharWidth)) <= COL_COUNT) {
+        n++;
     }
+    drawChars(xBase, yBase, str, n);
 }
 
 int
@@ -525,11 +693,9 @@ st7789vShowText(int xBase, int yBase, int width, int height,
                 i++;
             }
             if (newline) break;
-            while (i--) {
-                st7789vDrawChar(x, y, *str);
-                str++;
-                x += st7789vCharWidth;
-            }
+            drawChars(x, y, str, i);
+            str += i;
+            x += i * st7789vCharWidth;
             if ((*str == '\0') || (*str == '\n')) {
                 break;
             }
@@ -543,19 +709,33 @@ st7789vShowText(int xBase, int yBase, int width, int height,
 }
 
 
+/*
+ * Convert RGB565 to 8 bits per component
+ */
+static void
+pixelToRGB(int v, unsigned char *rgb)
+{
+    int r = (v >> 11) & 0x1F;
+    int g = (v >> 5) & 0x3F;
+    int b = v & 0x1F;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
 /*
  * Produce NetPBM PPM dump of screen contents
- * Warning -- Takes a long time!
  */
 void
 st7789vDumpScreen(void)
 {
     int x, y;
+    unsigned char rgb[3];
     printf("P3\n%d %d 255\n", COL_COUNT, ROW_COUNT);
     for (y = 0 ; y < ROW_COUNT ; y++) {
         for (x = 0 ; x < COL_COUNT ; x++) {
-            int v = st7789vColorAtPixel(x, y);
-            printf("%d %d %d\n", (v >> 16) & 0xFF, (v >> 8) & 0xFF, v & 0xFF);
+            pixelToRGB(shadow[y][x], rgb);
+            printf("%d %d %d\n", rgb[0], rgb[1], rgb[2]);
         }
     }
 }
@@ -563,46 +743,34 @@ st7789vDumpScreen(void)
 #ifdef ST7789_GRAB_SCREEN
 /*
  * Produce file of NETBPM portable pixmap screen image
+ * The entire image is assembled in memory and written in one operation.
  */
 #include "ffs.h"
-static int
-writeImage(FIL *fp)
-{
-    int r, c;
-
-    for (r = 0 ; r < ROW_COUNT ; r++) {
-        for (c = 0 ; c < COL_COUNT ; c++) {
-            int v = st7789vColorAtPixel(c, r);
-            UINT nWritten;
-            char cbuf[3];
-            cbuf[0] = v >> 16;
-            cbuf[1] = v >> 8;
-            cbuf[2] = v;
-            if ((f_write(fp, cbuf, 3, &nWritten) != FR_OK) || (nWritten != 3)) {
-                return 0;
-            }
-        }
-    }
-    return 1;
-}
-
 int
 st7789vGrabScreen(void)
 {
     FRESULT fr;
     FIL fil;
     UINT nWritten;
-    int l;
+    int l, r, c;
     int ret = 1;
-    char cbuf[20];
+    static unsigned char image[20 + (ROW_COUNT * COL_COUNT * 3)];
+    unsigned char *cp;
 
+    l = sprintf((char *)image, "P6\n%d %d 255\n", COL_COUNT, ROW_COUNT);
+    cp = image + l;
+    for (r = 0 ; r < ROW_COUNT ; r++) {
+        for (c = 0 ; c < COL_COUNT ; c++) {
+            pixelToRGB(shadow[r][c], cp);
+            cp += 3;
+        }
+    }
+    l = cp - image;
     fr = f_open(&fil, "/SCREEN.ppm", FA_WRITE | FA_CREATE_ALWAYS);
     if (fr != FR_OK) {
         return 0;
     }
-    l = sprintf(cbuf, "P6\n%d %d 255\n", COL_COUNT, ROW_COUNT);
-    if ((f_write(&fil, cbuf, l, &nWritten) != FR_OK) || (nWritten != l)
-     || !writeImage(&fil)) {
+    if ((f_write(&fil, image, l, &nWritten) != FR_OK) || (nWritten != l)) {
         ret = 0;
     }
     if (f_close(&fil) != FR_OK) {
@@ -58,6 +58,7 @@ extern int st7789vCharWidth, st7789vCharHeight;
 
 void st7789vInit(void);
 void st7789vAwaitCompletion(void);
+int st7789vFlush(unsigned int microseconds);
 void st7789vShow(void);
 void st7789vBacklightEnable(int enable);
 
@@ -72,6 +73,7 @@ int st7789vColorAtPixel(int x, int y);
 void st7789vTestPattern(void);
 
 void st7789vSetCharacterRGB(int foreground, int background);
+void st7789vGlyphCacheStats(unsigned int *hits, unsigned int *misses);
 void st7789vDrawChar(int x, int y, int c);
 void st7789vShowString(int xBase, int yBase, const char *str);
 int st7789vShowText(int xBase, int yBase, int width, int height,
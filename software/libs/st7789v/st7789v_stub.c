@@ -50,6 +50,12 @@ void
 st7789vAwaitCompletion(void)
 {}
 
+int
+st7789vFlush(unsigned int microseconds)
+{
+    return 0;
+}
+
 void
 st7789vBacklightEnable(int enable)
 {}
@@ -99,6 +105,13 @@ void
 st7789vSetCharacterRGB(int foreground, int background)
 {}
 
+void
+st7789vGlyphCacheStats(unsigned int *hits, unsigned int *misses)
+{
+    *hits = 0;
+    *misses = 0;
+}
+
 /*
  * Draw a character with left upper corner at (x, y)
  */
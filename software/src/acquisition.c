@@ -6,6 +6,7 @@
 #include "acquisition.h"
 #include "afe.h"
 #include "gpio.h"
+#include "trace.h"
 #include "util.h"
 
 #ifdef VERILOG_FIRMWARE_STYLE_HSD
@@ -101,9 +102,7 @@ acquisitionArm(int channel, int enable)
         csr = 0;
     }
     GPIO_WRITE(REG(GPIO_IDX_ADC_0_CSR, channel), csr);
-    if (debugFlags & DEBUGFLAG_ACQUISITION) {
-        printf("%srm %d\n", enable ? "A" : "Disa", channel);
-    }
+    TRACE(DEBUGFLAG_ACQUISITION, TRACE_ACQ_ARM, channel, enable, csr, 0);
 }
 
 
@@ -135,9 +134,9 @@ acquisitionStatus(uint32_t status[], int capacity)
                 status[channel/16] = v;
                 numSets = channel/16+1;
             }
-            if ((debugFlags & DEBUGFLAG_ACQUISITION) && (v != 0)) {
-                printf("Channel set %d: FULL %02X  ACTIVE %02x\n",
-                        channel/16, ((int)v >> 16),(int)v & 0xFFFF);
+            if (v != 0) {
+                TRACE(DEBUGFLAG_ACQUISITION, TRACE_ACQ_STATUS, channel/16,
+                                                  v >> 16, v & 0xFFFF, 0);
             }
             v = 0;
         }
@@ -228,13 +227,8 @@ acquisitionNormalFetch(uint32_t *buf, int capacity, int channel, int triggerChan
         int loc;
         uint32_t v = 0;
         if (offset == 0) {
-            if (debugFlags & DEBUGFLAG_ACQUISITION) {
-                printf("Chan:%d(t%d) trigger@%d (%d:%d)\n", channel,
-                                   triggerChannel,
-                                   triggerLocation,
-                                   triggerLocation / CFG_AXI_SAMPLES_PER_CLOCK,
-                                   triggerLocation % CFG_AXI_SAMPLES_PER_CLOCK);
-            }
+            TRACE(DEBUGFLAG_ACQUISITION, TRACE_ACQ_READOUT, channel,
+                                        triggerChannel, triggerLocation, 0);
             *buf++ = GPIO_READ(REG(GPIO_IDX_ADC_0_SECONDS, triggerChannel));
             *buf++ = GPIO_READ(REG(GPIO_IDX_ADC_0_FRACTION, triggerChannel));
             *buf++ = GPIO_READ(REG(GPIO_IDX_ADC_0_PROP, triggerChannel));
@@ -304,13 +298,8 @@ acquisitionMeanFetch(uint32_t *buf, int capacity, int channel, int triggerChanne
         int loc;
         float m = 0.0;
         if (segOffset == 0) {
-            if (debugFlags & DEBUGFLAG_ACQUISITION) {
-                printf("Chan:%d(t%d) trigger@%d (%d:%d)\n", channel,
-                                   triggerChannel,
-                                   triggerLocation,
-                                   triggerLocation / CFG_AXI_SAMPLES_PER_CLOCK,
-                                   triggerLocation % CFG_AXI_SAMPLES_PER_CLOCK);
-            }
+            TRACE(DEBUGFLAG_ACQUISITION, TRACE_ACQ_READOUT, channel,
+                                        triggerChannel, triggerLocation, 0);
             *buf++ = GPIO_READ(REG(GPIO_IDX_ADC_0_SECONDS, triggerChannel));
             *buf++ = GPIO_READ(REG(GPIO_IDX_ADC_0_FRACTION, triggerChannel));
             /* The data read by the FPGA will be processed and
@@ -346,10 +335,8 @@ acquisitionMeanFetch(uint32_t *buf, int capacity, int channel, int triggerChanne
 
         m = mean((int32_t *)meanSegmentBuff, samplesPerSegment);
 
-        if (debugFlags & DEBUGFLAG_ACQUISITION) {
-            printf("Mean of segment %d (channel %d): %f\n",
-                    offset, channel, m);
-        }
+        TRACE(DEBUGFLAG_ACQUISITION, TRACE_ACQ_SEGMENT_MEAN, channel, offset,
+                                                            traceFloat(m), 0);
 
         offset++;
         n++;
@@ -402,9 +389,8 @@ setTrigger(int channel, uint32_t mask, uint32_t v)
     triggerReg &= ~mask;
     triggerReg |= v & mask;
     GPIO_WRITE(REG(GPIO_IDX_ADC_0_TRIGGER_CONFIG, channel), triggerReg);
-    if (debugFlags & DEBUGFLAG_ACQUISITION) {
-        printf("Trigger %d config: %08X\n", channel, triggerReg);
-    }
+    TRACE(DEBUGFLAG_ACQUISITION, TRACE_ACQ_TRIGGER_CONFIG, channel,
+                                                            triggerReg, 0, 0);
     acqConfig[channel].triggerReg = triggerReg;
 }
 
@@ -417,9 +403,8 @@ acquisitionSetTriggerLevel(int channel, int microvolts)
 
     triggerLevels[channel] = microvolts;
     counts = afeMicrovoltsToCounts(channel, microvolts);
-    if (debugFlags & DEBUGFLAG_CALIBRATION) {
-        printf("C%d uV:%d adc:%d\n", channel, microvolts, counts);
-    }
+    TRACE(DEBUGFLAG_CALIBRATION, TRACE_ACQ_TRIGGER_LEVEL, channel,
+                                                    microvolts, counts, 0);
     setTrigger(channel, TRIGGER_CONFIG_LEVEL_MASK, counts);
 
 }
@@ -566,9 +551,9 @@ acquisitionStatus(uint32_t status[], int capacity)
                     status[channel/16] = v;
                     numSets = channel/16+1;
                 }
-                if ((debugFlags & DEBUGFLAG_ACQUISITION) && (v != 0)) {
-                    printf("Channel set %d: FULL %02X  ACTIVE %02x\n",
-                            channel/16, ((int)v >> 16),(int)v & 0xFFFF);
+                if (v != 0) {
+                    TRACE(DEBUGFLAG_ACQUISITION, TRACE_ACQ_STATUS, channel/16,
+                                                      v >> 16, v & 0xFFFF, 0);
                 }
                 v = 0;
             }
@@ -641,13 +626,11 @@ void acquisitionSetPassCount(unsigned int n) { }
 #include "bcmProtocol.h"
 #include "gpio.h"
 #include "rfadc.h"
+#include "trace.h"
 #include "util.h"
 
 #define EVENT_TRIGGER_TIMEOUT_US 3000000
 
-#define DEBUGFLAG_SOFT_TRIGGER 0x100000
-#define DEBUGFLAG_READ_TIMEOUT 0x200000
-
 #define ACQ_CHANNEL_COUNT       2
 
 #define CSR_W_START             0x80000000
@@ -761,23 +744,18 @@ acquisitionCrank(void)
         if (!(csr & CSR_RW_SOFT_TRIGGER)
          && ((now - usWhenStarted) > EVENT_TRIGGER_TIMEOUT_US)) {
             CSR_WRITE(CSR_RW_SOFT_TRIGGER);
-            if (debugFlags & DEBUGFLAG_SOFT_TRIGGER) {
-                printf("==== Soft trigger\n");
-            }
+            TRACE(DEBUGFLAG_ACQUISITION, TRACE_ACQ_SOFT_TRIGGER, 0, 0, 0, 0);
         }
     }
     else {
         if (wasStarted) {
             wasStarted = 0;
             usWhenFinished = now;
-            if (debugFlags & DEBUGFLAG_READ_TIMEOUT) {
-                printf("Acq: %d us\n", usWhenFinished - usWhenStarted);
-            }
+            TRACE(DEBUGFLAG_ACQUISITION, TRACE_ACQ_COMPLETE,
+                                usWhenFinished - usWhenStarted, 0, 0, 0);
         }
         if ((now - usWhenFinished) > 5000000) {
-            if (debugFlags & DEBUGFLAG_READ_TIMEOUT) {
-                printf("==== Cancel readout\n");
-            }
+            TRACE(DEBUGFLAG_ACQUISITION, TRACE_ACQ_CANCEL, 0, 0, 0, 0);
             acquisitionStart();
         }
     }
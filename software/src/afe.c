@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <xparameters.h>
 #include "acquisition.h"
 #include "afe.h"
@@ -13,6 +14,7 @@
 #include "gpio.h"
 #include "iic.h"
 #include "rfadc.h"
+#include "trace.h"
 #include "util.h"
 
 #define AFE_CHANNEL_COUNT   8
@@ -316,6 +318,10 @@ calibrate(int channel)
     afeSetDAC(oldDAC);
     // Restore coupling
     afeSetCoupling(channel, coupling);
+    TRACE(DEBUGFLAG_CALIBRATION, TRACE_AFE_CALIBRATION, channel,
+                                                afeConfig[channel].gainCode,
+                                                afeConfig[channel].gndReading,
+                                                afeConfig[channel].calReading);
     if (debugFlags & DEBUGFLAG_CALIBRATION) {
         float dacVolts = (2.5 * afeConfig[channel].calDAC) / 65536.0;
         float countsPerVolt =
@@ -338,7 +344,11 @@ afeADCrestart(void)
 {
     int i;
 
-    if (afeMissing) return;
+    if (afeMissing) {
+        rfADCrestart();
+        rfADCsync();
+        return;
+    }
     // Apply 0V to all ADCs
     // DAC can drive 0V to all channels simultaneously since
     // termination resistors are connected to ground.
@@ -414,9 +424,7 @@ afeEnableTrainingTone(int enable)
 {
     uint32_t csr = GPIO_READ(GPIO_IDX_CALIBRATION_CSR);
     if (afeMissing) return;
-    if (debugFlags & DEBUGFLAG_CALIBRATION) {
-        printf("afeEnableTrainingTone(%d)\n", enable);
-    }
+    TRACE(DEBUGFLAG_CALIBRATION, TRACE_AFE_TRAINING_TONE, enable, 0, 0, 0);
     if (enable) {
         csr |= CALIBRATION_CSR_ENABLE_TONE;
     }
@@ -482,10 +490,16 @@ afeFetchADCextents(uint32_t *buf)
 /*
  * EEPROM I/O
  */
+#define AFE_EEPROM_SIZE         128
+#define AFE_EEPROM_PAGE_SIZE    16
+#define AFE_EEPROM_IIC_INDEX    ((0x50 << 8) | IIC_INDEX_RFMC)
+#define AFE_EEPROM_POLL_US      100
+#define AFE_EEPROM_TIMEOUT_US   10000
+
 int
 afeFetchEEPROM(void)
 {
-    uint8_t buf[128];
+    uint8_t buf[AFE_EEPROM_SIZE];
     FRESULT fr;
     FIL fil;
     UINT nWritten = -1;
@@ -498,7 +512,7 @@ afeFetchEEPROM(void)
     if (fr != FR_OK) {
         return -1;
     }
-    if (iicRead((0x50 << 8) | IIC_INDEX_RFMC, 0, buf, sizeof buf)) {
+    if (iicRead(AFE_EEPROM_IIC_INDEX, 0, buf, sizeof buf)) {
         f_write(&fil, buf, sizeof buf, &nWritten);
     }
     f_close(&fil);
@@ -508,16 +522,34 @@ afeFetchEEPROM(void)
 
 /*
  * Copy file to AFE EEPROM
+ * Only pages whose contents differ are written.  A write cycle
+ * in progress is detected by the device not acknowledging its address.
  */
+static int
+afeEEPROMpoll(const uint8_t *buf, int n)
+{
+    uint32_t then = MICROSECONDS_SINCE_BOOT();
+
+    while (!iicWrite(AFE_EEPROM_IIC_INDEX, buf, n)) {
+        if ((MICROSECONDS_SINCE_BOOT() - then) > AFE_EEPROM_TIMEOUT_US) {
+            return 0;
+        }
+        microsecondSpin(AFE_EEPROM_POLL_US);
+    }
+    return 1;
+}
+
 int
 afeStashEEPROM(void)
 {
-    int address = 0;
-    int pass;
-    uint8_t buf[17];
+    int address, haveOld;
+    int pageCount = 0;
+    uint8_t newBuf[AFE_EEPROM_SIZE];
+    uint8_t oldBuf[AFE_EEPROM_SIZE];
+    uint8_t xBuf[1+AFE_EEPROM_PAGE_SIZE];
     FRESULT fr;
     FIL fil;
-    UINT nRead = -1;
+    UINT nRead = 0;
 
     if (afeMissing) {
         return -1;
@@ -527,30 +559,30 @@ afeStashEEPROM(void)
     if (fr != FR_OK) {
         return -1;
     }
-
-    for (;;) {
-        fr = f_read(&fil, buf+1, sizeof(buf)-1, &nRead);
-        if (fr != FR_OK) {
-            printf("IIC file read failed\n");
-            break;
-        }
-        if (nRead == 0) {
-            break;
+    fr = f_read(&fil, newBuf, sizeof newBuf, &nRead);
+    f_close(&fil);
+    if (fr != FR_OK) {
+        printf("IIC file read failed\n");
+        return -1;
+    }
+    haveOld = iicRead(AFE_EEPROM_IIC_INDEX, 0, oldBuf, sizeof oldBuf);
+    for (address = 0 ; address < nRead ; address += AFE_EEPROM_PAGE_SIZE) {
+        int n = nRead - address;
+        if (n > AFE_EEPROM_PAGE_SIZE) n = AFE_EEPROM_PAGE_SIZE;
+        if (haveOld && (memcmp(newBuf+address, oldBuf+address, n) == 0)) {
+            continue;
         }
-        pass = 0;
-        buf[0] = address;
-        while (!iicWrite((0x50 << 8) | IIC_INDEX_RFMC, buf, nRead + 1)) {
-            if (++pass > 12) {
-                printf("IIC EEPROM write failed\n");
-                f_close(&fil);
-                return -1;
-            }
-            microsecondSpin(500);
+        xBuf[0] = address;
+        memcpy(xBuf + 1, newBuf + address, n);
+        if (!afeEEPROMpoll(xBuf, n + 1) || !afeEEPROMpoll(xBuf, 1)) {
+            printf("IIC EEPROM write failed\n");
+            return -1;
         }
-        address += nRead;
+        pageCount++;
+    }
+    if (debugFlags & DEBUGFLAG_IIC) {
+        printf("AFE EEPROM: %d page%s written\n", pageCount,
+                                                    pageCount == 1 ? "" : "s");
     }
-
-    f_close(&fil);
-
     return nRead;
 }
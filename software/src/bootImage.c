@@ -0,0 +1,240 @@
+/*
+ * Firmware (BOOT.bin) update
+ *
+ * An incoming image is written to a staging file while its CRC-32 is
+ * computed and its boot header checked as each TFTP block arrives, so
+ * there's no need to read the image back from the SD card.
+ *
+ * Once the image is validated the running image is renamed BOOT0001.bin
+ * and the staging file becomes BOOT.bin.  Should BOOT.bin be missing or
+ * damaged the boot ROM golden image search falls back to BOOT0001.bin.
+ *
+ * A client can have the CRC checked by sending the image with the
+ * expected value as eight hex digits before the extension,
+ * e.g., BOOT_1A2B3C4D.bin.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "bootImage.h"
+#include "ffs.h"
+#include "util.h"
+
+#define FALLBACK_IMAGE_NAME "BOOT0001.bin"
+#define STAGING_IMAGE_NAME  "BOOTNEW.bin"
+
+/*
+ * Zynq UltraScale+ boot header
+ */
+#define HEADER_WIDTH_DETECTION_OFFSET   0x20
+#define HEADER_IMAGE_ID_OFFSET          0x24
+#define HEADER_CHECKSUM_OFFSET          0x48
+#define HEADER_SIZE                     0x4C
+#define HEADER_WIDTH_DETECTION          0xAA995566
+#define HEADER_IMAGE_ID                 0x584C4E58  /* "XNLX" */
+
+static struct bootImageUpdate {
+    int           isActive;
+    int           haveExpectedCRC;
+    uint32_t      expectedCRC;
+    uint32_t      crc;
+    uint32_t      byteCount;
+    unsigned char header[HEADER_SIZE];
+} update;
+
+static struct bootImageResult {
+    uint32_t      crc;
+    uint32_t      byteCount;
+    const char   *status;
+} result = { 0, 0, "None" };
+
+/*
+ * IEEE 802.3 CRC-32, the same as zlib crc32() and 'crc32' utility
+ */
+static uint32_t
+crc32Update(uint32_t crc, const unsigned char *cp, int n)
+{
+    static uint32_t table[256];
+    static int beenHere;
+
+    if (!beenHere) {
+        uint32_t i, j, c;
+        for (i = 0 ; i < 256 ; i++) {
+            c = i;
+            for (j = 0 ; j < 8 ; j++) {
+                c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+        beenHere = 1;
+    }
+    crc = ~crc;
+    while (n--) {
+        crc = table[(crc ^ *cp++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t
+headerWord(int offset)
+{
+    const unsigned char *cp = update.header + offset;
+    return cp[0] | (cp[1] << 8) | (cp[2] << 16) | ((uint32_t)cp[3] << 24);
+}
+
+static int
+headerIsValid(void)
+{
+    int offset;
+    uint32_t sum = 0;
+
+    if ((headerWord(HEADER_WIDTH_DETECTION_OFFSET) != HEADER_WIDTH_DETECTION)
+     || (headerWord(HEADER_IMAGE_ID_OFFSET) != HEADER_IMAGE_ID)) {
+        return 0;
+    }
+    for (offset = HEADER_WIDTH_DETECTION_OFFSET ;
+                            offset < HEADER_CHECKSUM_OFFSET ; offset += 4) {
+        sum += headerWord(offset);
+    }
+    return ~sum == headerWord(HEADER_CHECKSUM_OFFSET);
+}
+
+/*
+ * Start of transfer
+ * Return name of file to which image is to be written.
+ */
+const char *
+bootImagePreReceive(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    int i;
+
+    memset(&update, 0, sizeof update);
+    if ((ext != NULL) && ((ext - name) >= 8)) {
+        for (i = 1 ; i <= 8 ; i++) {
+            if (!isxdigit((unsigned char)ext[-i])) break;
+        }
+        if (i > 8) {
+            update.expectedCRC = strtoul(ext - 8, NULL, 16);
+            update.haveExpectedCRC = 1;
+        }
+    }
+    update.isActive = 1;
+    result.status = "Receiving";
+    return STAGING_IMAGE_NAME;
+}
+
+/*
+ * Called with each block as it arrives
+ */
+void
+bootImageReceiveData(const char *buf, int n)
+{
+    if (!update.isActive) return;
+    if (update.byteCount < HEADER_SIZE) {
+        int nCopy = HEADER_SIZE - update.byteCount;
+        if (nCopy > n) nCopy = n;
+        memcpy(update.header + update.byteCount, buf, nCopy);
+    }
+    update.crc = crc32Update(update.crc, (const unsigned char *)buf, n);
+    update.byteCount += n;
+}
+
+/*
+ * Validate the received image
+ * Return 0 if there's no image, -1 if the image is bad, image size otherwise.
+ */
+int
+bootImagePostReceive(void)
+{
+    FILINFO fno;
+    FRESULT fr;
+
+    if (!update.isActive) return 0;
+    update.isActive = 0;
+    result.crc = update.crc;
+    result.byteCount = update.byteCount;
+    if ((update.byteCount < HEADER_SIZE) || !headerIsValid()) {
+        result.status = "Bad boot header";
+    }
+    else if (update.haveExpectedCRC && (update.crc != update.expectedCRC)) {
+        result.status = "CRC mismatch";
+    }
+    else if ((fr = f_stat(STAGING_IMAGE_NAME, &fno)) != FR_OK) {
+        result.status = ffsStrerror(fr);
+    }
+    else if (fno.fsize != update.byteCount) {
+        result.status = "Size mismatch";
+    }
+    else {
+        result.status = "Validated";
+        printf("Boot image: %u bytes, CRC-32 %08X.\n",
+                                (unsigned int)result.byteCount,
+                                (unsigned int)result.crc);
+        return update.byteCount;
+    }
+    printf("Boot image rejected: %s.\n", result.status);
+    f_unlink(STAGING_IMAGE_NAME);
+    return -1;
+}
+
+/*
+ * Transfer failed or was abandoned
+ */
+void
+bootImageAbort(void)
+{
+    if (!update.isActive) return;
+    update.isActive = 0;
+    result.crc = update.crc;
+    result.byteCount = update.byteCount;
+    result.status = "Aborted";
+    printf("Boot image transfer aborted.\n");
+    f_unlink(STAGING_IMAGE_NAME);
+}
+
+/*
+ * Switch to new image
+ * Each rename is a single directory entry update, and the
+ * golden image search finds the fallback image between the two.
+ */
+void
+bootImageCommit(void)
+{
+    FRESULT fr;
+
+    fr = f_unlink(FALLBACK_IMAGE_NAME);
+    if ((fr != FR_OK) && (fr != FR_NO_FILE)) {
+        warn("Can't remove %s: %s", FALLBACK_IMAGE_NAME, ffsStrerror(fr));
+        result.status = "Fallback not removed";
+        return;
+    }
+    fr = f_rename(BOOT_IMAGE_NAME, FALLBACK_IMAGE_NAME);
+    if ((fr != FR_OK) && (fr != FR_NO_FILE)) {
+        warn("Can't rename %s: %s", BOOT_IMAGE_NAME, ffsStrerror(fr));
+        result.status = "Active image not renamed";
+        return;
+    }
+    fr = f_rename(STAGING_IMAGE_NAME, BOOT_IMAGE_NAME);
+    if (fr != FR_OK) {
+        warn("Can't rename %s: %s", STAGING_IMAGE_NAME, ffsStrerror(fr));
+        f_rename(FALLBACK_IMAGE_NAME, BOOT_IMAGE_NAME);
+        result.status = "New image not installed";
+        return;
+    }
+    result.status = "Installed";
+    printf("Boot image installed, previous image is %s.\n",
+                                                        FALLBACK_IMAGE_NAME);
+}
+
+void
+bootImageShow(void)
+{
+    printf("Boot image update: %s", result.status);
+    if (result.byteCount) {
+        printf(" (%u bytes, CRC-32 %08X)", (unsigned int)result.byteCount,
+                                           (unsigned int)result.crc);
+    }
+    printf("\n");
+}
@@ -0,0 +1,18 @@
+/*
+ * Firmware (BOOT.bin) update
+ */
+#ifndef _BOOT_IMAGE_H_
+#define _BOOT_IMAGE_H_
+
+#include <stdint.h>
+
+#define BOOT_IMAGE_NAME     "BOOT.bin"
+
+const char *bootImagePreReceive(const char *name);
+void bootImageReceiveData(const char *buf, int n);
+int bootImagePostReceive(void);
+void bootImageCommit(void);
+void bootImageAbort(void);
+void bootImageShow(void);
+
+#endif  /* _BOOT_IMAGE_H_ */
@@ -11,7 +11,9 @@
 #include <xuartps_hw.h>
 #include "acquisition.h"
 #include "afe.h"
+#include "bootImage.h"
 #include "display.h"
+#include "eventLogger.h"
 #include "evr.h"
 #include "eyescan.h"
 #include "ffs.h"
@@ -26,6 +28,7 @@
 #include "sysmon.h"
 #include "sysref.h"
 #include "systemParameters.h"
+#include "trace.h"
 #include "user_mgt_refclk.h"
 #include "util.h"
 #include "serdes.h"
@@ -39,19 +42,24 @@ static enum consoleMode consoleMode;
 
 /*
  * UDP console support
+ * Output is sent when a packet's worth has accumulated or when the
+ * oldest character has been waiting for the flush latency.
  */
 #define CONSOLE_UDP_PORT    50004
 #define UDP_CONSOLE_BUF_SIZE    1400
+#define UDP_CONSOLE_FLUSH_US    100000
 static struct udpConsole {
     struct udp_pcb *pcb;
     char            obuf[UDP_CONSOLE_BUF_SIZE];
     int             outIndex;
     uint32_t        usAtFirstOutputCharacter;
+    uint32_t        flushLatencyUs;
+    uint32_t        dropCount;
     struct pbuf    *pbufIn;
     int             inIndex;
     ip_addr_t       fromAddr;
     uint16_t        fromPort;
-} udpConsole;
+} udpConsole = { .flushLatencyUs = UDP_CONSOLE_FLUSH_US };
 
 static void
 udpConsoleDrain(void)
@@ -59,12 +67,66 @@ udpConsoleDrain(void)
     struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, udpConsole.outIndex, PBUF_RAM);
     if (p) {
         memcpy(p->payload, udpConsole.obuf, udpConsole.outIndex);
-        udp_sendto(udpConsole.pcb, p, &udpConsole.fromAddr, udpConsole.fromPort);
+        if (udp_sendto(udpConsole.pcb, p, &udpConsole.fromAddr,
+                                            udpConsole.fromPort) != ERR_OK) {
+            udpConsole.dropCount += udpConsole.outIndex;
+        }
         pbuf_free(p);
     }
+    else {
+        udpConsole.dropCount += udpConsole.outIndex;
+    }
     udpConsole.outIndex = 0;
 }
 
+/*
+ * UART output
+ * Once the main loop is running characters are queued and moved to the
+ * UART transmitter FIFO as space becomes available so that diagnostic
+ * output doesn't stall the caller for the duration of the serial transfer.
+ * Characters that don't fit in the queue are discarded and counted.
+ * Output is unbuffered before the main loop starts and after consoleFlush().
+ */
+#define UART_TX_QUEUE_SIZE  32768   /* Must be a power of 2 */
+static struct uartTx {
+    char      buf[UART_TX_QUEUE_SIZE];
+    uint32_t  head;
+    uint32_t  tail;
+    uint32_t  dropCount;
+    int       isQueued;
+} uartTx;
+
+static void
+uartTxCrank(void)
+{
+    while ((uartTx.tail != uartTx.head)
+        && !XUartPs_IsTransmitFull(STDOUT_BASEADDRESS)) {
+        XUartPs_WriteReg(STDOUT_BASEADDRESS, XUARTPS_FIFO_OFFSET,
+                             uartTx.buf[uartTx.tail++ & (UART_TX_QUEUE_SIZE-1)]);
+    }
+}
+
+static int
+uartTxSpace(void)
+{
+    return UART_TX_QUEUE_SIZE - (uartTx.head - uartTx.tail);
+}
+
+/*
+ * Send all pending output and stop queueing UART output.
+ * Used before a reset or when the main loop is no longer running.
+ */
+void
+consoleFlush(void)
+{
+    uartTx.isQueued = 0;
+    while (uartTx.tail != uartTx.head) {
+        XUartPs_SendByte(STDOUT_BASEADDRESS,
+                             uartTx.buf[uartTx.tail++ & (UART_TX_QUEUE_SIZE-1)]);
+    }
+    if (udpConsole.fromPort && udpConsole.outIndex) udpConsoleDrain();
+}
+
 /*
  * Convert <newline> to <carriage return><newline> so
  * we can use normal looking printf format strings.
@@ -85,7 +147,15 @@ outbyte(char8 c)
 
     if ((c == '\n') && !wasReturn) outbyte('\r');
     wasReturn = (c == '\r');
-    XUartPs_SendByte(STDOUT_BASEADDRESS, c);
+    if (!uartTx.isQueued) {
+        XUartPs_SendByte(STDOUT_BASEADDRESS, c);
+    }
+    else if (uartTxSpace() > 0) {
+        uartTx.buf[uartTx.head++ & (UART_TX_QUEUE_SIZE-1)] = c;
+    }
+    else {
+        uartTx.dropCount++;
+    }
     if (isStartup && (startIdx < STARTBUF_SIZE))
         startBuf[startIdx++] = c;
     if (udpConsole.fromPort) {
@@ -110,7 +180,8 @@ cmdLOGactive(void)
 
     if (consoleMode == consoleModeLogReplay) {
         if (i < startIdx) {
-            outbyte(startBuf[i++]);
+            /* Leave room for <return> */
+            if (uartTxSpace() >= 2) outbyte(startBuf[i++]);
             return 1;
         }
         else {
@@ -129,7 +200,7 @@ bootQueryCallback(int argc, char **argv)
 {
     if (argc == 1) {
         if (strcasecmp(argv[0], "Y") == 0) {
-            if (udpConsole.fromPort) udpConsoleDrain();
+            consoleFlush();
             microsecondSpin(1000);
             resetFPGA();
             return;
@@ -147,6 +218,7 @@ cmdBOOT(int argc, char **argv)
 {
     char *cp = NULL;
 
+    bootImageShow();
     consoleMode = consoleModeBootQuery;
     bootQueryCallback(0, &cp);
     return 0;
@@ -178,6 +250,66 @@ cmdCAL(int argc, char **argv)
     return 0;
 }
 
+static int
+cmdCLK(int argc, char **argv)
+{
+    char *endp;
+    int i;
+    uint32_t args[RFCLK_SETTINGS_COUNT];
+
+    if (argc == 1) {
+        rfClkShowSamplingClock();
+        return 0;
+    }
+    if (argc != (RFCLK_SETTINGS_COUNT + 1)) {
+        printf("Usage: clk [kHz MMCMmul MMCMdiv0 MMCMdiv1 ADCperSYSREF "
+                                                        "REFperSYSREF]\n");
+        printf("       MMCM values are scaled by a factor of 1000.\n");
+        printf("       kHz must be the present value since synthesizer "
+                                      "values can't be given here.\n");
+        return 1;
+    }
+    for (i = 0 ; i < RFCLK_SETTINGS_COUNT ; i++) {
+        args[i] = strtol(argv[i+1], &endp, 0);
+        if (*endp != '\0') {
+            printf("Bad argument '%s'.\n", argv[i+1]);
+            return 1;
+        }
+    }
+    if (rfClkReconfigureRequest(args, RFCLK_SETTINGS_COUNT) < 0) {
+        printf("Reconfiguration request rejected.\n");
+        rfClkShowSamplingClock();
+        return 1;
+    }
+    return 0;
+}
+
+static int
+cmdCONSOLE(int argc, char **argv)
+{
+    char *endp;
+    int ms;
+
+    if (argc > 2) {
+        printf("Usage: console [UDPflushLatencyMs]\n");
+        return 1;
+    }
+    if (argc == 2) {
+        ms = strtol(argv[1], &endp, 0);
+        if ((*endp != '\0') || (ms < 0) || (ms > 10000)) {
+            printf("Bad argument '%s'.\n", argv[1]);
+            return 1;
+        }
+        udpConsole.flushLatencyUs = ms * 1000;
+    }
+    printf("UART: %d bytes pending, %u dropped.\n",
+                UART_TX_QUEUE_SIZE - uartTxSpace(), (unsigned int)uartTx.dropCount);
+    printf(" UDP: %d ms flush latency, %u bytes dropped.\n",
+                (int)(udpConsole.flushLatencyUs / 1000),
+                (unsigned int)udpConsole.dropCount);
+    return 0;
+}
+
 static int
 cmdDEBUG(int argc, char **argv)
 {
@@ -209,16 +341,38 @@ cmdDEBUG(int argc, char **argv)
     if (debugFlags & DEBUGFLAG_RESYNC_ADC) rfADCsync();
     if (sFlag) {
         systemParameters.startupDebugFlags = debugFlags;
-        systemParametersFetchEEPROM();
+        systemParametersWriteEEPROM();
         printf("Startup debug flags: 0x%x\n", debugFlags);
     }
     return 0;
 }
 
+static int
+cmdDISPLAY(int argc, char **argv)
+{
+    char *endp;
+    int us;
+
+    if (argc > 2) {
+        printf("Usage: display [us]\n");
+        return 1;
+    }
+    if (argc == 2) {
+        us = strtol(argv[1], &endp, 0);
+        if ((*endp != '\0') || (displaySetUpdateBudget(us) < 0)) {
+            printf("Bad argument '%s'.\n", argv[1]);
+            return 1;
+        }
+    }
+    printf("Display update limit: %d us per pass\n", displayGetUpdateBudget());
+    return 0;
+}
+
 static int
 cmdEVR(int argc, char **argv)
 {
     evrShow();
+    mgtShowStatistics();
     return 0;
 }
 
@@ -241,9 +395,19 @@ cmdFMON(int argc, char **argv)
         printf("           Frequency measurements are low accuracy.\n");
     }
     for (i = 0 ; i < sizeof names / sizeof names[0] ; i++) {
-        printf("%16s clock:%*.*f\n", names[i], usingPPS ? 11 : 8,
-                                               usingPPS ? 6 : 4,
-                                               frequencyMonitorGet(i) / 1.0e6);
+        struct frequencyMonitorStats stats;
+        printf("%16s clock:%*.*f", names[i], usingPPS ? 11 : 8,
+                                             usingPPS ? 6 : 4,
+                                             frequencyMonitorGet(i) / 1.0e6);
+        if (frequencyMonitorGetStats(i, &stats) > 1) {
+            printf("  min:%*.*f  max:%*.*f  sd:%u Hz",
+                                usingPPS ? 11 : 8, usingPPS ? 6 : 4,
+                                stats.min / 1.0e6,
+                                usingPPS ? 11 : 8, usingPPS ? 6 : 4,
+                                stats.max / 1.0e6,
+                                stats.stddev);
+        }
+        printf("\n");
     }
     return 0;
 }
@@ -258,7 +422,7 @@ netQueryCallback(int argc, char **argv)
     if (argc == 1) {
         if (strcasecmp(argv[0], "Y") == 0) {
             systemParameters.netConfig.ipv4 = ipv4;
-            systemParametersFetchEEPROM();
+            systemParametersWriteEEPROM();
             consoleMode = consoleModeCommand;
             return;
         }
@@ -331,7 +495,7 @@ macQueryCallback(int argc, char **argv)
     if (argc == 1) {
         if (strcasecmp(argv[0], "Y") == 0) {
             memcpy(systemParameters.netConfig.ethernetMAC,macBuf, sizeof macBuf);
-            systemParametersFetchEEPROM();
+            systemParametersWriteEEPROM();
             consoleMode = consoleModeCommand;
             return;
         }
@@ -419,100 +583,48 @@ cmdREG(int argc, char **argv)
     return 0;
 }
 
+/*
+ * Capture continues until a character is received
+ * Arguments are event codes to be ignored, or -r for raw time stamps.
+ */
 static int
 cmdTLOG(int argc, char **argv)
 {
-    uint32_t csr;
-    static int isActive, isFirstHB, todBitCount;
-    static int rAddr;
-    static int addrMask;
-    int pass = 0;
-
     if (argc < 0) {
-        if (isActive) {
-            GPIO_WRITE(GPIO_IDX_EVENT_LOG_CSR, 0);
-            isActive = 0;
+        if (eventLoggerStop()) {
+            eventLoggerShow();
         }
         return 0;
     }
     if (argc > 0) {
-        csr = GPIO_READ(GPIO_IDX_EVENT_LOG_CSR);
-        addrMask = ~(~0UL << ((csr >> 24) & 0xF));
-        GPIO_WRITE(GPIO_IDX_EVENT_LOG_CSR, 0x80000000);
-        rAddr = 0;
-        isActive = 1;
-        isFirstHB = 1;
-        todBitCount = 0;
-        return 0;
-    }
-    if (isActive) {
-        int wAddr, wAddrOld;
-        static uint32_t lastHbTicks, lastEvTicks, todShift;
-        csr = GPIO_READ(GPIO_IDX_EVENT_LOG_CSR);
-        wAddrOld = csr & addrMask;
-        for (;;) {
-            csr = GPIO_READ(GPIO_IDX_EVENT_LOG_CSR);
-            wAddr = csr & addrMask;
-            if (wAddr == wAddrOld) break;
-            if (++pass > 10) {
-                printf("Event logger unstable!\n");
-                isActive = 0;
-                return 0;
-            }
-            wAddrOld = wAddr;
-        }
-        for (pass = 0 ; rAddr != wAddr ; ) {
-            int event;
-            GPIO_WRITE(GPIO_IDX_EVENT_LOG_CSR, 0x80000000 | rAddr);
-            rAddr = (rAddr + 1) & addrMask;
-            event = (GPIO_READ(GPIO_IDX_EVENT_LOG_CSR) >> 16) & 0xFF;
-            if (event == 112) {
-                todBitCount++;
-                todShift = (todShift << 1) | 0;
-            }
-            else if (event == 113) {
-                todBitCount++;
-                todShift = (todShift << 1) | 1;
+        int i, isRaw = 0, ignoreCount = 0;
+        int ignoreCodes[8];
+        char *endp;
+        for (i = 1 ; i < argc ; i++) {
+            if (strcmp(argv[i], "-r") == 0) {
+                isRaw = 1;
             }
             else {
-                uint32_t ticks = GPIO_READ(GPIO_IDX_EVENT_LOG_TICKS);
-                switch(event) {
-                case 122:
-                    if (isFirstHB) {
-                        printf("HB\n");
-                        isFirstHB = 0;
-                    }
-                    else {
-                        printf("HB %d\n", ticks - lastHbTicks);
-                    }
-                    lastHbTicks = ticks;
-                    break;
-
-                case 125:
-                    if (todBitCount == 32) {
-                        printf("PPS %d\n", todShift);
-                    }
-                    else {
-                        printf("PPS\n");
-                    }
-                    todBitCount = 0;
-                    break;
-
-                default:
-                    printf("%d %d\n", event, ticks - lastEvTicks);
-                    lastEvTicks = ticks;
-                    break;
+                int code = strtol(argv[i], &endp, 0);
+                if ((*endp != '\0') || (code <= 0) || (code > 255)) {
+                    printf("Bad event code '%s'.\n", argv[i]);
+                    printf("Usage: tlog [-r] [ignoredEventCode ...]\n");
+                    return 0;
                 }
-            }
-            if (++pass >= addrMask) {
-                printf("Event logger can't keep up.\n");
-                isActive = 0;
-                return 0;
+                if (ignoreCount >= (sizeof ignoreCodes/sizeof ignoreCodes[0])) {
+                    printf("At most %d event codes can be ignored.\n",
+                            (int)(sizeof ignoreCodes/sizeof ignoreCodes[0]));
+                    return 0;
+                }
+                ignoreCodes[ignoreCount++] = code;
             }
         }
-        return 1;
+        eventLoggerStart(isRaw, ignoreCount, ignoreCodes);
+        printf("Capturing events to %s -- any key to stop.\n",
+                                                        EVENT_LOGGER_FILE_NAME);
+        return 0;
     }
-    return 0;
+    return eventLoggerCrank();
 }
 
 static int
@@ -526,7 +638,7 @@ cmdUMGT(int argc, char **argv)
             else if (offsetPPM < -3500) offsetPPM = -3500;
             if (userMGTrefClkAdjust(systemParameters.userMGTrefClkOffsetPPM)) {
                 systemParameters.userMGTrefClkOffsetPPM = offsetPPM;
-                systemParametersFetchEEPROM();
+                systemParametersWriteEEPROM();
             }
         }
     }
@@ -542,8 +654,11 @@ struct commandInfo {
 static struct commandInfo commandTable[] = {
   { "boot",   cmdBOOT,  "Reboot FPGA"                        },
   { "cal"  ,  cmdCAL,   "Set calibration signals"            },
+  { "clk",    cmdCLK,   "Show or set ADC sampling clock"     },
+  { "console",cmdCONSOLE,"Console queues, UDP flush latency" },
   { "DIR",    ffsShow,  "Show micro SD cards files"          },
   { "debug",  cmdDEBUG, "Set debug flags"                    },
+  { "display",cmdDISPLAY,"Set display update time limit"     },
   { "evr",    cmdEVR,   "Show EVR configuration"             },
   { "fmon"  , cmdFMON,  "Show clock frequencies"             },
   { "log",    cmdLOG,   "Replay startup console output"      },
@@ -552,6 +667,7 @@ static struct commandInfo commandTable[] = {
   { "reg",    cmdREG,   "Show GPIO register(s)"              },
   { "stats",  cmdSTATS, "Show network statistics"            },
   { "tlog",   cmdTLOG,  "Timing system event logger"         },
+  { "trace",  traceCommand,"Set diagnostic trace flags"      },
   { "userMGT",cmdUMGT,  "User MGT reference clock adjustment"},
   { "values", cmdSYSMON,"Show system monitor values"         },
   { "xcvr",   eyescanCommand,"Perform transceiver eye scan"  },
@@ -656,10 +772,12 @@ consoleCheck(void)
         if (err != ERR_OK)
             fatal("Can't bind to console port, error:%d", err);
         udp_recv(udpConsole.pcb, console_callback, NULL);
+        uartTx.isQueued = 1;
     }
+    uartTxCrank();
     if (udpConsole.outIndex != 0) {
-        if ((MICROSECONDS_SINCE_BOOT() - udpConsole.usAtFirstOutputCharacter) >
-                                                                       100000) {
+        if ((MICROSECONDS_SINCE_BOOT() - udpConsole.usAtFirstOutputCharacter) >=
+                                                    udpConsole.flushLatencyUs) {
             udpConsoleDrain();
         }
     }
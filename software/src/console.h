@@ -6,5 +6,6 @@
 #define _SHELL_H_
 
 void consoleCheck(void);
+void consoleFlush(void);
 
 #endif
@@ -22,6 +22,22 @@
 #define DISPLAY_MODE_UPDATE -1
 #define DISPLAY_MODE_FETCH  -2
 
+/*
+ * Drawing routines change only the in-memory copy of the screen.
+ * Changes are sent to the display a slice at a time from the main loop.
+ * Until the main loop is running, send changes immediately.
+ */
+static int isRunning;
+static int updateBudget = DISPLAY_UPDATE_MICROSECONDS;
+
+static void
+flushIfNotRunning(void)
+{
+    if (!isRunning) {
+        st7789vFlush(0);
+    }
+}
+
 static void
 drawHeartbeatIndicator(void)
 {
@@ -447,7 +463,30 @@ displayRefresh(int newMode)
 void
 displayUpdate(void)
 {
+    isRunning = 1;
     displayRefresh(-1);
+    st7789vFlush(updateBudget);
+}
+
+/*
+ * Set limit on time spent each main loop pass
+ * A value of 0 sends all pending changes.
+ */
+int
+displaySetUpdateBudget(int microseconds)
+{
+    if ((microseconds < 0)
+     || (microseconds > DISPLAY_UPDATE_MICROSECONDS_MAX)) {
+        return -1;
+    }
+    updateBudget = microseconds;
+    return 0;
+}
+
+int
+displayGetUpdateBudget(void)
+{
+    return updateBudget;
 }
 
 void
@@ -468,6 +507,7 @@ displayShowFatal(const char *msg)
     displaySetMode(DISPLAY_MODE_FATAL);
     st7789vShowText(4, 4, DISPLAY_WIDTH - 4, DISPLAY_HEIGHT - 4,
                                                ST7789V_BLACK, ST7789V_RED, msg);
+    flushIfNotRunning();
 }
 
 void
@@ -509,6 +549,7 @@ displayShowWarning(const char *msg)
                        DISPLAY_WIDTH - 2, displayYsize - yNext,
                        ST7789V_BLACK, ST7789V_YELLOW, msg);
         }
+        flushIfNotRunning();
         return;
     }
     st7789vFlood(0, 0, 2, displayYsize, ST7789V_YELLOW);
@@ -533,4 +574,5 @@ displayShowStatusLine(const char *cp)
                         DISPLAY_WIDTH, st7789vCharHeight,
                         ST7789V_WHITE, ST7789V_BLACK, cp);
     }
+    flushIfNotRunning();
 }
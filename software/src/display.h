@@ -9,6 +9,13 @@
 
 #define DISPLAY_ENABLE_SECONDS 1200
 
+/*
+ * Default limit on time spent sending changes to the display
+ * each main loop pass
+ */
+#define DISPLAY_UPDATE_MICROSECONDS 100
+#define DISPLAY_UPDATE_MICROSECONDS_MAX 100000
+
 #define DISPLAY_MODE_STARTUP    0
 #define DISPLAY_MODE_PAGES      1
 #define DISPLAY_MODE_WARNING    2
@@ -17,6 +24,8 @@
 void displayUpdate(void);
 void displaySetMode(int mode);
 int displayGetMode(void);
+int displaySetUpdateBudget(int microseconds);
+int displayGetUpdateBudget(void);
 void drawIPv4Address(const void *ipv4address, int isRecoveryMode);
 
 void displayShowFatal(const char *msg);
@@ -0,0 +1,262 @@
+/*
+ * Transceiver dynamic reconfiguration port (drpControl.v) access
+ *
+ * Transceiver attribute registers change only when written through the
+ * DRP so their values are shadowed and read-modify-write operations need
+ * not read the port, nor write it when the value is unchanged.  Registers
+ * at or above DRP_SHADOW_LIMIT hold status and are always read from the
+ * port.  A failed read leaves the shadow untouched.
+ *
+ * Writes made between drpBegin() and drpEnd() are queued.  Multiple
+ * changes to a register are merged into a single write and drpEnd()
+ * issues the queued writes back-to-back in the order in which each
+ * register was first modified.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include "drp.h"
+#include "gpio.h"
+#include "util.h"
+
+#define DRP_SHADOW_LIMIT    0x250
+#define DRP_BATCH_CAPACITY  16
+
+#define DRP_CSR_BUSY        (1UL << 31)
+#define DRP_CSR_WRITE       (1UL << 31)
+#define DRP_CSR_RESET       (1UL << 30)
+
+static struct drpPort {
+    uint16_t    shadow[DRP_SHADOW_LIMIT];
+    uint8_t     isValid[DRP_SHADOW_LIMIT];
+    int         inBatch;
+    int         batchCount;
+    uint16_t    batch[DRP_BATCH_CAPACITY];
+} drpPorts[DRP_PORT_CAPACITY];
+
+static struct drpStatistics {
+    unsigned int reads;
+    unsigned int writes;
+    unsigned int shadowHits;
+    unsigned int merges;    /* Writes avoided */
+} stats;
+
+static int
+awaitIdle(int port, int regOffset, const char *op, uint32_t *csrp)
+{
+    int pass = 0;
+    uint32_t csr;
+
+    while ((csr = GPIO_READ(GPIO_IDX_EVR_GTY_DRP+port)) & DRP_CSR_BUSY) {
+        if (++pass == 10) {
+            printf("Port %d, reg 0x%x drp_%s failed.\n", port, regOffset, op);
+            return 0;
+        }
+    }
+    if (csrp) *csrp = csr;
+    return 1;
+}
+
+static void
+portWrite(int port, int regOffset, int value)
+{
+    GPIO_WRITE(GPIO_IDX_EVR_GTY_DRP+port,
+                       DRP_CSR_WRITE | (regOffset << 16) | (value & 0xFFFF));
+    stats.writes++;
+    if (debugFlags & DEBUGFLAG_DRP) {
+        printf("%x:%04x <- %04X\n", port, regOffset, value & 0xFFFF);
+    }
+    awaitIdle(port, regOffset, "write", NULL);
+}
+
+/*
+ * Return -1 if the port does not respond
+ */
+static int
+portRead(int port, int regOffset)
+{
+    uint32_t csr;
+
+    GPIO_WRITE(GPIO_IDX_EVR_GTY_DRP+port, regOffset << 16);
+    stats.reads++;
+    if (!awaitIdle(port, regOffset, "read", &csr)) {
+        return -1;
+    }
+    if (debugFlags & DEBUGFLAG_DRP) {
+        printf("%x:%04x -> %04X\n", port, regOffset, (int)(csr & 0xFFFF));
+    }
+    return csr & 0xFFFF;
+}
+
+static int
+isPending(struct drpPort *dp, int regOffset)
+{
+    int i;
+
+    for (i = 0 ; i < dp->batchCount ; i++) {
+        if (dp->batch[i] == regOffset) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Issue queued writes in the order they were queued
+ */
+static void
+flushBatch(int port)
+{
+    struct drpPort *dp = &drpPorts[port];
+    int i;
+
+    for (i = 0 ; i < dp->batchCount ; i++) {
+        int regOffset = dp->batch[i];
+        portWrite(port, regOffset, dp->shadow[regOffset]);
+    }
+    dp->batchCount = 0;
+}
+
+/*
+ * Read from port, or from shadow if a write to the register is pending.
+ * Return -1 if the port does not respond.
+ */
+static int
+shadowRead(int port, int regOffset)
+{
+    struct drpPort *dp = &drpPorts[port];
+    int value;
+
+    if ((regOffset < DRP_SHADOW_LIMIT) && dp->inBatch
+                                       && isPending(dp, regOffset)) {
+        return dp->shadow[regOffset];
+    }
+    value = portRead(port, regOffset);
+    if ((value >= 0) && (regOffset < DRP_SHADOW_LIMIT)) {
+        dp->shadow[regOffset] = value;
+        dp->isValid[regOffset] = 1;
+    }
+    return value;
+}
+
+/*
+ * Failed reads return 0
+ */
+int
+drpRead(int port, int regOffset)
+{
+    int value = shadowRead(port, regOffset);
+    return value < 0 ? 0 : value;
+}
+
+void
+drpWrite(int port, int regOffset, int value)
+{
+    struct drpPort *dp = &drpPorts[port];
+
+    if (regOffset >= DRP_SHADOW_LIMIT) {
+        /* Unshadowed register -- keep it behind the queued writes */
+        if (dp->inBatch) flushBatch(port);
+        portWrite(port, regOffset, value);
+        return;
+    }
+    dp->shadow[regOffset] = value;
+    dp->isValid[regOffset] = 1;
+    if (dp->inBatch) {
+        if (isPending(dp, regOffset)) {
+            stats.merges++;
+            return;
+        }
+        if (dp->batchCount == DRP_BATCH_CAPACITY) flushBatch(port);
+        dp->batch[dp->batchCount++] = regOffset;
+        return;
+    }
+    portWrite(port, regOffset, value);
+}
+
+void
+drpRMW(int port, int regOffset, int mask, int value)
+{
+    struct drpPort *dp = &drpPorts[port];
+    int r;
+    uint16_t old, v;
+
+    if ((regOffset < DRP_SHADOW_LIMIT) && dp->isValid[regOffset]) {
+        old = dp->shadow[regOffset];
+        stats.shadowHits++;
+    }
+    else {
+        /* Don't write back a value that was never read */
+        if ((r = shadowRead(port, regOffset)) < 0) return;
+        old = r;
+    }
+    v = (old & ~mask) | (value & mask);
+    if ((v == old) && (regOffset < DRP_SHADOW_LIMIT)) {
+        stats.merges++;
+        return;
+    }
+    drpWrite(port, regOffset, v);
+}
+
+void
+drpSet(int port, int regOffset, int bits)
+{
+    drpRMW(port, regOffset, bits, bits);
+}
+
+void
+drpClr(int port, int regOffset, int bits)
+{
+    drpRMW(port, regOffset, bits, 0);
+}
+
+/*
+ * Queue writes
+ */
+void
+drpBegin(int port)
+{
+    struct drpPort *dp = &drpPorts[port];
+
+    dp->inBatch = 1;
+    dp->batchCount = 0;
+}
+
+/*
+ * Issue queued writes
+ */
+void
+drpEnd(int port)
+{
+    flushBatch(port);
+    drpPorts[port].inBatch = 0;
+}
+
+/*
+ * Drive the drpControl reset output
+ * Shadowed values can't be trusted once the reset has been applied.
+ */
+void
+drpReset(int port, int reset)
+{
+    GPIO_WRITE(GPIO_IDX_EVR_GTY_DRP+port, DRP_CSR_RESET | (reset != 0));
+    if (reset) drpInvalidate(port);
+}
+
+/*
+ * Forget shadowed values, e.g. after transceiver reconfiguration
+ */
+void
+drpInvalidate(int port)
+{
+    struct drpPort *dp = &drpPorts[port];
+    int i;
+
+    for (i = 0 ; i < DRP_SHADOW_LIMIT ; i++) {
+        dp->isValid[i] = 0;
+    }
+}
+
+void
+drpShowStatistics(void)
+{
+    printf("DRP reads:%u writes:%u shadow hits:%u merged writes:%u\n",
+                    stats.reads, stats.writes, stats.shadowHits, stats.merges);
+}
@@ -0,0 +1,22 @@
+/*
+ * Transceiver dynamic reconfiguration port (drpControl.v) access
+ *
+ * Port numbers are relative to GPIO_IDX_EVR_GTY_DRP.
+ */
+#ifndef _DRP_H_
+#define _DRP_H_
+
+#define DRP_PORT_CAPACITY   4
+
+int drpRead(int port, int regOffset);
+void drpWrite(int port, int regOffset, int value);
+void drpRMW(int port, int regOffset, int mask, int value);
+void drpSet(int port, int regOffset, int bits);
+void drpClr(int port, int regOffset, int bits);
+void drpBegin(int port);
+void drpEnd(int port);
+void drpReset(int port, int reset);
+void drpInvalidate(int port);
+void drpShowStatistics(void);
+
+#endif  /* _DRP_H_ */
@@ -11,11 +11,15 @@
 #include "epics.h"
 #include "epicsApplicationCommands.h"
 #include "evr.h"
+#include "eyescan.h"
+#include "frequencyMonitor.h"
 #include "gpio.h"
 #include "mgt.h"
+#include "rfadc.h"
 #include "rfclk.h"
 #include "softwareBuildDate.h"
 #include "sysmon.h"
+#include "trace.h"
 #include "util.h"
 
 /*
@@ -60,6 +64,29 @@ setEventAction(int event, uint32_t action)
     evrSetEventAction(event, action);
 }
 
+/*
+ * Timing system health
+ */
+static uint32_t
+timingStatus(void)
+{
+    int mgt = mgtStatus();
+    int evr = evrHealthStatus();
+    uint32_t status = 0;
+
+    if (mgt & MGT_STATUS_ALIGNED)
+        status |= HSD_PROTOCOL_TIMING_EVR_ALIGNED;
+    if (mgt & MGT_STATUS_ALIGNMENT_LATE)
+        status |= HSD_PROTOCOL_TIMING_EVR_ALIGNMENT_LATE;
+    if (evr & EVR_HEALTH_CHECKED)
+        status |= HSD_PROTOCOL_TIMING_MARKERS_CHECKED;
+    if (evr & EVR_HEALTH_HEARTBEAT_OK)
+        status |= HSD_PROTOCOL_TIMING_HEARTBEAT_OK;
+    if (evr & EVR_HEALTH_PPS_OK)
+        status |= HSD_PROTOCOL_TIMING_PPS_OK;
+    return status;
+}
+
 /*
  * Handle a reboot request
  */
@@ -118,13 +145,17 @@ epicsCommonCommand(int commandArgCount, struct hsdPacket *cmdp,
             break;
 
         case HSD_PROTOCOL_CMD_LONGIN_IDX_RFADC_SAMPLING_CLK:
-            replyp->args[0] = CFG_ADC_SAMPLING_CLK_FREQ*1000; // kHz
+            replyp->args[0] = rfADCsamplingClockKHz();
             break;
 
         case HSD_PROTOCOL_CMD_LONGIN_IDX_GIT_HASH_ID:
             replyp->args[0] = GPIO_READ(GPIO_IDX_GITHASH);
             break;
 
+        case HSD_PROTOCOL_CMD_LONGIN_IDX_TIMING_STATUS:
+            replyp->args[0] = timingStatus();
+            break;
+
         default: return -1;
         }
         break;
@@ -193,12 +224,18 @@ epicsCommonCommand(int commandArgCount, struct hsdPacket *cmdp,
         replyArgCount += afeFetchADCextents(replyp->args+replyArgCount);
         replyp->args[replyArgCount++] = (CFG_ADC_PHYSICAL_COUNT << 16) |
                                                                   powerUpStatus;
+        replyArgCount += rfADCfetchEventCounts(replyp->args+replyArgCount);
+        replyArgCount += rfADCfetchLatencies(replyp->args+replyArgCount);
+        replyArgCount += lmx2594FetchStatus(replyp->args+replyArgCount);
+        replyArgCount += frequencyMonitorFetch(replyp->args+replyArgCount);
         break;
 
     case HSD_PROTOCOL_CMD_HI_PLL_CONFIG:
         switch (lo) {
         case HSD_PROTOCOL_CMD_PLL_CONFIG_LO_SET:
-            lmx2594ConfigAllSame(cmdp->args, commandArgCount);
+            if (rfClkSynthesizerRequest(cmdp->args, commandArgCount) < 0) {
+                return -1;
+            }
             replyArgCount = 0;
             break;
 
@@ -207,6 +244,13 @@ epicsCommonCommand(int commandArgCount, struct hsdPacket *cmdp,
                                                      HSD_PROTOCOL_ARG_CAPACITY);
             break;
 
+        case HSD_PROTOCOL_CMD_PLL_CONFIG_LO_SAMPLING_CLK:
+            if (rfClkReconfigureRequest(cmdp->args, commandArgCount) < 0) {
+                return -1;
+            }
+            replyArgCount = 0;
+            break;
+
         default: return -1;
         }
         break;
@@ -217,6 +261,18 @@ epicsCommonCommand(int commandArgCount, struct hsdPacket *cmdp,
                   HSD_PROTOCOL_ARG_CAPACITY, idx, cmdp->args[0], cmdp->args[1]);
         break;
 
+    case HSD_PROTOCOL_CMD_HI_EVENT_LOG:
+        if (commandArgCount != 1) return -1;
+        replyArgCount = evrFetchEventLog(replyp->args,
+                                     HSD_PROTOCOL_ARG_CAPACITY, cmdp->args[0]);
+        break;
+
+    case HSD_PROTOCOL_CMD_HI_EYESCAN:
+        if (commandArgCount != 1) return -1;
+        replyArgCount = eyescanFetch(replyp->args, HSD_PROTOCOL_ARG_CAPACITY,
+                                                           idx, cmdp->args[0]);
+        break;
+
     default: return -1;
     }
     return replyArgCount;
@@ -236,14 +292,7 @@ epics_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
     static int replySize;
     static uint32_t lastNonce;
 
-    if (debugFlags & DEBUGFLAG_EPICS) {
-        printf("epics_callback: %d from %d.%d.%d.%d:%d\n", p->len,
-                                                    (int)((addr >> 24) & 0xFF),
-                                                    (int)((addr >> 16) & 0xFF),
-                                                    (int)((addr >>  8) & 0xFF),
-                                                    (int)((addr      ) & 0xFF),
-                                                    fromPort);
-    }
+    TRACE(DEBUGFLAG_EPICS, TRACE_EPICS_PACKET, p->len, addr, fromPort, 0);
 
     /*
      * Ignore weird-sized packets
@@ -251,10 +300,8 @@ epics_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
     if ((p->len < HSD_PROTOCOL_ARG_COUNT_TO_SIZE(0))
      || (p->len > sizeof command)
      || ((p->len % sizeof(uint32_t)) != 0)) {
+        TRACE(DEBUGFLAG_EPICS, TRACE_EPICS_BAD_SIZE, p->len, 0, 0, 0);
         pbuf_free(p);
-        if (debugFlags & DEBUGFLAG_EPICS) {
-            printf("Unreasonable packet size\n");
-        }
         return;
     }
     commandArgCount = HSD_PROTOCOL_SIZE_TO_ARG_COUNT(p->len);
@@ -270,10 +317,8 @@ epics_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
         bswap32(&command.magic, p->len / sizeof(int32_t));
     }
     if (command.magic == HSD_PROTOCOL_MAGIC) {
-        if (debugFlags & DEBUGFLAG_EPICS) {
-            printf("Command:%X args:%d  %x\n", (unsigned int)command.command,
-                               commandArgCount, (unsigned int)command.args[0]);
-        }
+        TRACE(DEBUGFLAG_EPICS, TRACE_EPICS_COMMAND, command.command,
+                        commandArgCount, command.args[0], command.nonce);
         if (command.nonce != lastNonce) {
             int replyArgCount;
             memcpy(&reply, &command, HSD_PROTOCOL_ARG_COUNT_TO_SIZE(0));
@@ -289,16 +334,12 @@ epics_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
                 bswap32(&reply.magic, replySize / sizeof(int32_t));
             }
         }
-        if (debugFlags & DEBUGFLAG_EPICS) {
-            printf("Reply:%d\n", replySize);
-        }
+        TRACE(DEBUGFLAG_EPICS, TRACE_EPICS_REPLY, replySize, command.command,
+                                                                        0, 0);
         sendReply(pcb, &reply, replySize, fromAddr, fromPort);
     }
     else {
-        if (debugFlags & DEBUGFLAG_EPICS) {
-            printf("Bad magic number 0x%08X, expecting 0x%08X\n",
-                    command.magic, HSD_PROTOCOL_MAGIC);
-        }
+        TRACE(DEBUGFLAG_EPICS, TRACE_EPICS_BAD_MAGIC, command.magic, 0, 0, 0);
     }
 }
 
@@ -0,0 +1,310 @@
+/*
+ * Timing system event logger (evrLogger.v) capture
+ *
+ * Entries are moved from the logger buffer to a RAM ring each time
+ * through the main loop.  The logger normally stores compressed entries,
+ * two per buffer word, and can be told to ignore selected event codes.
+ * Time of day shift events are decoded and the remaining events are
+ * stored with the decoded time of day and the interval since the most
+ * recent heartbeat.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "eventLogger.h"
+#include "ffs.h"
+#include "gpio.h"
+#include "util.h"
+
+#define CSR_W_RUN               0x80000000
+#define CSR_W_FILTER            0x40000000
+#define CSR_W_COMPRESS          0x20000000
+#define CSR_W_FILTER_IGNORE     0x100
+#define CSR_R_RUNNING           0x80000000
+#define CSR_R_COMPRESSING       0x40000000
+#define CSR_R_OVERFLOW          0x20000000
+#define CSR_R_ADDR_WIDTH_SHIFT  24
+#define CSR_R_EVENT_SHIFT       16
+
+#define EVENT_TOD_SHIFT_0       112
+#define EVENT_TOD_SHIFT_1       113
+#define EVENT_HEARTBEAT         122
+#define EVENT_PPS               125
+
+#define RING_CAPACITY           16384
+
+static struct eventLoggerEntry ring[RING_CAPACITY];
+
+static struct eventLogger {
+    int         isActive;
+    int         isCompressed;
+    uint32_t    csrRun;
+    int         addrMask;
+    int         rAddr;
+    uint32_t    head;           /* Count of entries ever stored */
+    uint32_t    overruns;
+    int         overflowed;
+    uint32_t    todShift;
+    int         todBitCount;
+    uint32_t    seconds;
+    int         haveHeartbeat;
+    uint32_t    lastHeartbeatTicks;
+    uint32_t    heartbeatCount;
+    uint32_t    heartbeatMin;
+    uint32_t    heartbeatMax;
+    uint32_t    ppsCount;
+    uint32_t    todBitErrors;
+    uint32_t    whenStarted;
+    struct eventLoggerDecoder decoder;
+} logger;
+
+/*
+ * Compressed mode is used unless raw time stamps are requested
+ * or the logger predates compression.
+ */
+void
+eventLoggerStart(int isRaw, int ignoreCount, const int *ignoreCodes)
+{
+    int i;
+    uint32_t csr;
+
+    memset(&logger, 0, sizeof logger);
+    for (i = 0 ; i < 256 ; i++) {
+        GPIO_WRITE(GPIO_IDX_EVENT_LOG_CSR, CSR_W_FILTER | i);
+    }
+    for (i = 0 ; i < ignoreCount ; i++) {
+        GPIO_WRITE(GPIO_IDX_EVENT_LOG_CSR, CSR_W_FILTER | CSR_W_FILTER_IGNORE |
+                                                       (ignoreCodes[i] & 0xFF));
+    }
+    GPIO_WRITE(GPIO_IDX_EVENT_LOG_CSR, isRaw ? 0 : CSR_W_COMPRESS);
+    csr = GPIO_READ(GPIO_IDX_EVENT_LOG_CSR);
+    logger.isCompressed = ((csr & CSR_R_COMPRESSING) != 0);
+    logger.csrRun = CSR_W_RUN | (logger.isCompressed ? CSR_W_COMPRESS : 0);
+    logger.addrMask = ~(~0UL << (((csr >> CSR_R_ADDR_WIDTH_SHIFT) & 0xF) +
+                                                        logger.isCompressed));
+    eventLoggerDecoderInit(&logger.decoder);
+    logger.heartbeatMin = ~0;
+    logger.whenStarted = MICROSECONDS_SINCE_BOOT();
+    GPIO_WRITE(GPIO_IDX_EVENT_LOG_CSR, logger.csrRun);
+    logger.isActive = 1;
+}
+
+/*
+ * Return 1 if capture was active
+ */
+int
+eventLoggerStop(void)
+{
+    if (logger.isActive) {
+        eventLoggerCrank();
+        GPIO_WRITE(GPIO_IDX_EVENT_LOG_CSR, 0);
+        logger.isActive = 0;
+        return 1;
+    }
+    return 0;
+}
+
+static void
+storeEntry(int eventCode, uint32_t ticks)
+{
+    struct eventLoggerEntry *ep = &ring[logger.head % RING_CAPACITY];
+
+    switch (eventCode) {
+    case EVENT_HEARTBEAT:
+        if (logger.haveHeartbeat) {
+            uint32_t diff = ticks - logger.lastHeartbeatTicks;
+            if (diff < logger.heartbeatMin) logger.heartbeatMin = diff;
+            if (diff > logger.heartbeatMax) logger.heartbeatMax = diff;
+        }
+        logger.heartbeatCount++;
+        break;
+
+    case EVENT_PPS:
+        if (logger.todBitCount == 32) {
+            logger.seconds = logger.todShift;
+        }
+        else if (logger.todBitCount != 0) {
+            logger.todBitErrors++;
+        }
+        logger.todBitCount = 0;
+        logger.ppsCount++;
+        break;
+    }
+    ep->ticks = ticks;
+    ep->seconds = logger.seconds;
+    ep->sinceHeartbeat = logger.haveHeartbeat ?
+                                        ticks - logger.lastHeartbeatTicks : 0;
+    ep->eventCode = eventCode;
+    if (eventCode == EVENT_HEARTBEAT) {
+        logger.haveHeartbeat = 1;
+        logger.lastHeartbeatTicks = ticks;
+    }
+    logger.head++;
+}
+
+static void
+storeEvent(int eventCode, uint32_t ticks)
+{
+    if ((eventCode == EVENT_TOD_SHIFT_0) || (eventCode == EVENT_TOD_SHIFT_1)) {
+        logger.todShift = (logger.todShift << 1) |
+                                            (eventCode == EVENT_TOD_SHIFT_1);
+        logger.todBitCount++;
+    }
+    else {
+        storeEntry(eventCode, ticks);
+    }
+}
+
+static void
+decodeEntry(uint32_t entry)
+{
+    int eventCode;
+    uint32_t ticks;
+
+    eventCode = eventLoggerDecode(&logger.decoder, entry, &ticks);
+    if (eventCode) {
+        storeEvent(eventCode, ticks);
+    }
+}
+
+/*
+ * Drain logger buffer.
+ * Return 1 if capture is active.
+ */
+int
+eventLoggerCrank(void)
+{
+    int wAddr, wAddrOld, pending;
+    int pass = 0;
+    uint32_t csr;
+
+    if (!logger.isActive) return 0;
+    wAddrOld = GPIO_READ(GPIO_IDX_EVENT_LOG_CSR) & logger.addrMask;
+    for (;;) {
+        csr = GPIO_READ(GPIO_IDX_EVENT_LOG_CSR);
+        wAddr = csr & logger.addrMask;
+        if (wAddr == wAddrOld) break;
+        if (++pass > 10) {
+            printf("Event logger unstable!\n");
+            eventLoggerStop();
+            return 0;
+        }
+        wAddrOld = wAddr;
+    }
+
+    /*
+     * A full buffer may have wrapped.  The logger also flags writes
+     * past the point where the buffer was full, after which compressed
+     * entries may have been overwritten in the middle of a delta.
+     */
+    pending = (wAddr - logger.rAddr) & logger.addrMask;
+    if (pending == logger.addrMask) {
+        logger.overruns++;
+    }
+    if ((csr & CSR_R_OVERFLOW) && !logger.overflowed) {
+        logger.overflowed = 1;
+        printf("Event logger buffer overflowed!\n");
+    }
+
+    /*
+     * A compressed buffer word holds two entries and is read once
+     * unless its second entry had yet to be written.
+     */
+    while (logger.rAddr != wAddr) {
+        int eventCode;
+        uint32_t ticks;
+        GPIO_WRITE(GPIO_IDX_EVENT_LOG_CSR, logger.csrRun |
+                                    (logger.rAddr >> logger.isCompressed));
+        eventCode = (GPIO_READ(GPIO_IDX_EVENT_LOG_CSR) >> CSR_R_EVENT_SHIFT)
+                                                                        & 0xFF;
+        ticks = GPIO_READ(GPIO_IDX_EVENT_LOG_TICKS);
+        if (!logger.isCompressed) {
+            storeEvent(eventCode, ticks);
+        }
+        else {
+            if ((logger.rAddr & 0x1) == 0) {
+                decodeEntry(ticks & 0xFFFFF);
+                logger.rAddr = (logger.rAddr + 1) & logger.addrMask;
+                if (logger.rAddr == wAddr) break;
+            }
+            decodeEntry((eventCode << 12) | (ticks >> 20));
+        }
+        logger.rAddr = (logger.rAddr + 1) & logger.addrMask;
+    }
+    return 1;
+}
+
+/*
+ * Summarize capture
+ */
+void
+eventLoggerShow(void)
+{
+    uint32_t stored = logger.head < RING_CAPACITY ? logger.head : RING_CAPACITY;
+
+    printf("Event logger %s (%s), %u events captured in %u ms, "
+                                                          "%u retained.\n",
+                      logger.isActive ? "active" : "stopped",
+                      logger.isCompressed ? "compressed" : "raw",
+                      (unsigned int)logger.head,
+                      (unsigned int)((MICROSECONDS_SINCE_BOOT() -
+                                                     logger.whenStarted) / 1000),
+                      (unsigned int)stored);
+    if (logger.heartbeatCount > 1) {
+        printf("   Heartbeats: %u, interval %u to %u ticks\n",
+                                      (unsigned int)logger.heartbeatCount,
+                                      (unsigned int)logger.heartbeatMin,
+                                      (unsigned int)logger.heartbeatMax);
+    }
+    else {
+        printf("   Heartbeats: %u\n", (unsigned int)logger.heartbeatCount);
+    }
+    printf("   PPS: %u, time of day %u", (unsigned int)logger.ppsCount,
+                                         (unsigned int)logger.seconds);
+    if (logger.todBitErrors) {
+        printf(", %u incomplete", (unsigned int)logger.todBitErrors);
+    }
+    printf("\n");
+    if (logger.overruns) {
+        printf("   Logger buffer overruns: %u\n", (unsigned int)logger.overruns);
+    }
+    if (logger.overflowed) {
+        printf("   Logger buffer overflowed -- events lost%s.\n",
+                logger.isCompressed ? ", later time stamps unreliable" : "");
+    }
+}
+
+/*
+ * Write retained entries, oldest first, to a file for TFTP transfer
+ */
+int
+eventLoggerFetchFile(void)
+{
+    FRESULT fr;
+    FIL fil;
+    UINT nWritten;
+    uint32_t first, n;
+    int total = 0;
+
+    fr = f_open(&fil, "/"EVENT_LOGGER_FILE_NAME, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        return -1;
+    }
+    first = logger.head < RING_CAPACITY ? 0 : logger.head - RING_CAPACITY;
+    while (first != logger.head) {
+        int i = first % RING_CAPACITY;
+        n = logger.head - first;
+        if (n > (RING_CAPACITY - i)) n = RING_CAPACITY - i;
+        fr = f_write(&fil, &ring[i], n * sizeof ring[0], &nWritten);
+        if ((fr != FR_OK) || (nWritten != (n * sizeof ring[0]))) {
+            total = -1;
+            break;
+        }
+        total += nWritten;
+        first += n;
+    }
+    if (f_close(&fil) != FR_OK) {
+        return -1;
+    }
+    return total;
+}
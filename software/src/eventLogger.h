@@ -0,0 +1,43 @@
+/*
+ * Timing system event logger (evrLogger.v) capture
+ */
+#ifndef _EVENT_LOGGER_H_
+#define _EVENT_LOGGER_H_
+
+#include <stdint.h>
+
+#define EVENT_LOGGER_FILE_NAME  "EVENTLOG.bin"
+
+/*
+ * Captured events, also available by TFTP as EVENT_LOGGER_FILE_NAME.
+ * Time of day shift events (112, 113) are decoded rather than stored.
+ * Ticks of compressed captures count from the start of the capture.
+ */
+struct eventLoggerEntry {
+    uint32_t    ticks;          /* EVR clocks at arrival */
+    uint32_t    seconds;        /* Time of day, 0 until first decoded */
+    uint32_t    sinceHeartbeat; /* EVR clocks since most recent heartbeat */
+    uint8_t     eventCode;
+    uint8_t     pad[3];
+};
+
+/*
+ * Compressed logger entries (see evrLogger.v) are decoded by
+ * eventLoggerDecode, which is separate from the readout so
+ * that the gateware test bench can use it too.
+ */
+struct eventLoggerDecoder {
+    uint32_t    ticks;          /* EVR clocks at most recent event */
+    uint32_t    deltaHigh;      /* Upper bits of delta for next event */
+};
+void eventLoggerDecoderInit(struct eventLoggerDecoder *dp);
+int eventLoggerDecode(struct eventLoggerDecoder *dp, uint32_t entry,
+                                                     uint32_t *ticks);
+
+void eventLoggerStart(int isRaw, int ignoreCount, const int *ignoreCodes);
+int eventLoggerStop(void);
+int eventLoggerCrank(void);
+void eventLoggerShow(void);
+int eventLoggerFetchFile(void);
+
+#endif  /* _EVENT_LOGGER_H_ */
@@ -0,0 +1,48 @@
+/*
+ * Decode compressed timing system event logger (evrLogger.v) entries
+ *
+ * Each 20 bit entry holds an event code in the upper 8 bits and a
+ * delta in the lower 12 bits.  Event code 0 is never logged so
+ * entries with a code of 0 carry time only:
+ *   delta != 0 -- bits 23:12 of the delta for the following event
+ *   delta == 0 -- 2^24 EVR clocks elapsed with no event
+ */
+#include <stdint.h>
+#include "eventLogger.h"
+
+#define ENTRY_DELTA_WIDTH   12
+#define ENTRY_DELTA_MASK    ((1 << ENTRY_DELTA_WIDTH) - 1)
+#define IDLE_TICKS          (1UL << (2 * ENTRY_DELTA_WIDTH))
+
+void
+eventLoggerDecoderInit(struct eventLoggerDecoder *dp)
+{
+    dp->ticks = 0;
+    dp->deltaHigh = 0;
+}
+
+/*
+ * Return event code, or 0 if entry carries no event.
+ * Event arrival time is returned through the ticks pointer.
+ */
+int
+eventLoggerDecode(struct eventLoggerDecoder *dp, uint32_t entry,
+                                                 uint32_t *ticks)
+{
+    int eventCode = (entry >> ENTRY_DELTA_WIDTH) & 0xFF;
+    uint32_t delta = entry & ENTRY_DELTA_MASK;
+
+    if (eventCode == 0) {
+        if (delta == 0) {
+            dp->ticks += IDLE_TICKS;
+        }
+        else {
+            dp->deltaHigh = delta << ENTRY_DELTA_WIDTH;
+        }
+        return 0;
+    }
+    dp->ticks += dp->deltaHigh | delta;
+    dp->deltaHigh = 0;
+    *ticks = dp->ticks;
+    return eventCode;
+}
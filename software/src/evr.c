@@ -4,6 +4,7 @@
 #include <xparameters.h>
 #include "evr.h"
 #include "gpio.h"
+#include "mgt.h"
 #include "util.h"
 
 #define EVENT_HEARTBEAT         122
@@ -19,6 +20,86 @@
 #define EVR_RAM_A(e) (XPAR_EVR_AXI_0_BASEADDR+0x2000+((e)*sizeof(uint32_t)))
 #define EVR_RAM_B(e) (XPAR_EVR_AXI_0_BASEADDR+0x4000+((e)*sizeof(uint32_t)))
 
+#define EVR_REG28_FIFO_EMPTY    0x1
+#define EVR_REG28_FIFO_FULL     0x2
+
+/*
+ * Events from the time stamp FIFO.
+ * Filled only by evrCrank() so a reader needs no locking provided it
+ * checks that the entries it copied were not overwritten meanwhile.
+ * The FIFO write action is added to every event that drives an
+ * acquisition trigger so the log shows what triggered an acquisition
+ * and the IOC can match acquisition time stamps to event codes.
+ */
+#define EVR_EVENT_LOG_CAPACITY  1024
+#define EVR_ACQUISITION_TRIGGERS (EVR_RAM_TRIGGER_2 | EVR_RAM_TRIGGER_3 | \
+                                  EVR_RAM_TRIGGER_4 | EVR_RAM_TRIGGER_5 | \
+                                  EVR_RAM_TRIGGER_6 | EVR_RAM_TRIGGER_7)
+#define EVR_CRANK_EVENT_LIMIT   64
+static struct evrEventLog {
+    uint32_t            head;   /* Count of events ever logged */
+    uint32_t            fifoOverflows;
+    struct evrEvent {
+        evrTimestamp    when;
+        uint32_t        eventCode;
+    }                   entries[EVR_EVENT_LOG_CAPACITY];
+} eventLog;
+
+/*
+ * Reasons an event has the FIFO write action.
+ * The action is removed only when no reason remains.
+ */
+#define FIFO_OWNER_CALLER       0x1
+#define FIFO_OWNER_ACQUISITION  0x2
+#define FIFO_OWNER_HEALTH_CHECK 0x4
+static uint8_t fifoOwners[EVR_EVENT_COUNT];
+
+static unsigned int
+actionAddress(unsigned int eventNumber)
+{
+    unsigned int csr = Xil_In32(EVR_REG(17));
+
+    return (csr & EVR_REG17_BANK_B) ? EVR_RAM_B(eventNumber) :
+                                      EVR_RAM_A(eventNumber);
+}
+
+/*
+ * Actions as stored in the mapping RAM
+ */
+static int
+readAction(unsigned int eventNumber)
+{
+    if (eventNumber >= EVR_EVENT_COUNT) return 0;
+    return Xil_In32(actionAddress(eventNumber)) & 0xFFFF;
+}
+
+/*
+ * Store actions with the FIFO write action present if anything needs it
+ */
+static void
+writeAction(unsigned int eventNumber, int action)
+{
+    unsigned int addr = actionAddress(eventNumber);
+    uint32_t old = Xil_In32(addr);
+
+    action &= ~EVR_RAM_WRITE_FIFO;
+    if (fifoOwners[eventNumber]) action |= EVR_RAM_WRITE_FIFO;
+    Xil_Out32(addr, (old & ~0xFFFF) | (action & 0xFFFF));
+}
+
+static void
+setFifoOwner(unsigned int eventNumber, int owner, int isOwner)
+{
+    if (eventNumber >= EVR_EVENT_COUNT) return;
+    if (isOwner) {
+        fifoOwners[eventNumber] |= owner;
+    }
+    else {
+        fifoOwners[eventNumber] &= ~owner;
+    }
+    writeAction(eventNumber, readAction(eventNumber));
+}
+
 struct eventCheck {
     int      count;
     uint32_t ticks[2];
@@ -54,13 +135,177 @@ evGot(struct eventCheck *ep)
     ep->count++;
 }
 
+/*
+ * Move an event from the time stamp FIFO to the log.
+ * Return NULL if the FIFO was empty.
+ */
+static const struct evrEvent *
+logEventFromFIFO(void)
+{
+    uint32_t flags = Xil_In32(EVR_REG(28));
+    struct evrEvent *ep;
+
+    if (flags & EVR_REG28_FIFO_EMPTY) {
+        return NULL;
+    }
+    if (flags & EVR_REG28_FIFO_FULL) {
+        eventLog.fifoOverflows++;
+    }
+    ep = &eventLog.entries[eventLog.head % EVR_EVENT_LOG_CAPACITY];
+    ep->when.secPastEpoch = Xil_In32(EVR_REG(29));
+    ep->when.fraction = Xil_In32(EVR_REG(30));
+    /* Reading the event code pops the FIFO */
+    ep->eventCode = Xil_In32(EVR_REG(31));
+    eventLog.head++;
+    return ep;
+}
+
+/*
+ * Fetch logged events for the IOC
+ *  Word 0: Sequence number of next event to be logged
+ *  Word 1: Number of times the time stamp FIFO was found full
+ *  Then three words (seconds, fraction, event code) per event
+ *  starting with the event with the requested sequence number, or
+ *  the oldest event still in the log if that event has been overwritten.
+ */
+int
+evrFetchEventLog(uint32_t *buf, int capacity, uint32_t first)
+{
+    uint32_t head = eventLog.head;
+    int n = 2;
+
+    if (capacity < 2) return 0;
+    *buf++ = head;
+    *buf++ = eventLog.fifoOverflows;
+    if ((uint32_t)(head - first) > EVR_EVENT_LOG_CAPACITY) {
+        first = head - EVR_EVENT_LOG_CAPACITY;
+    }
+    while ((first != head) && ((n + 3) <= capacity)) {
+        const struct evrEvent *ep =
+                            &eventLog.entries[first % EVR_EVENT_LOG_CAPACITY];
+        *buf++ = ep->when.secPastEpoch;
+        *buf++ = ep->when.fraction;
+        *buf++ = ep->eventCode;
+        first++;
+        n += 3;
+    }
+    return n;
+}
+
+static void
+showEventLog(int count)
+{
+    uint32_t i = eventLog.head;
+
+    if (count > EVR_EVENT_LOG_CAPACITY) count = EVR_EVENT_LOG_CAPACITY;
+    if (count > eventLog.head) count = eventLog.head;
+    if (count == 0) return;
+    printf("   Most recent events:\n");
+    for (i = eventLog.head - count ; i != eventLog.head ; i++) {
+        const struct evrEvent *ep = &eventLog.entries[i % EVR_EVENT_LOG_CAPACITY];
+        printf("   %10u:%09u %3u\n", (unsigned int)ep->when.secPastEpoch,
+                                     (unsigned int)ep->when.fraction,
+                                     (unsigned int)ep->eventCode);
+    }
+    if (eventLog.fifoOverflows) {
+        printf("   FIFO overflows: %u\n", (unsigned int)eventLog.fifoOverflows);
+    }
+}
+
+/*
+ * Confirm that heartbeat and PPS markers are present.
+ * Runs in the background so startup need not wait for the event link.
+ * The interval starts again whenever the link is not aligned.
+ */
+#define HEALTH_CHECK_INTERVAL_US    6000000
 static struct eventCheck heartbeat, pps;
+static struct healthCheck {
+    int         isActive;
+    int         firstEvent0;
+    int         status;
+    uint32_t    whenStarted;
+} healthCheck;
+
+static void
+healthCheckEvent(const struct evrEvent *ep)
+{
+    int eventCode = ep->eventCode;
+
+    switch(eventCode) {
+    case EVENT_HEARTBEAT: evGot(&heartbeat); break;
+    case EVENT_PPS:       evGot(&pps);       break;
+    default:
+        /*
+         * For unknown reasons the event receiver often (always?)
+         * emits a spurious event 0 on startup.
+         */
+        if ((eventCode == 0) && healthCheck.firstEvent0) {
+            healthCheck.firstEvent0 = 0;
+            break;
+        }
+        printf("Warning -- Unexpected event %d (seconds/fraction:%d/%d)\n",
+                                    eventCode, (int)ep->when.secPastEpoch,
+                                               (int)ep->when.fraction);
+        break;
+    }
+}
+
+static void
+healthCheckCrank(void)
+{
+    if (!(mgtStatus() & MGT_STATUS_ALIGNED)) {
+        healthCheck.whenStarted = MICROSECONDS_SINCE_BOOT();
+        return;
+    }
+    if (((uint32_t)(MICROSECONDS_SINCE_BOOT() - healthCheck.whenStarted) >
+                                                    HEALTH_CHECK_INTERVAL_US)
+     || ((heartbeat.count >= 2) && (pps.count >= 2))) {
+        healthCheck.status = EVR_HEALTH_CHECKED;
+        if (evChk("Heartbeat", &heartbeat)) {
+            healthCheck.status |= EVR_HEALTH_HEARTBEAT_OK;
+        }
+        if (evChk("PPS", &pps)) {
+            healthCheck.status |= EVR_HEALTH_PPS_OK;
+        }
+        setFifoOwner(EVENT_HEARTBEAT, FIFO_OWNER_HEALTH_CHECK, 0);
+        setFifoOwner(EVENT_PPS, FIFO_OWNER_HEALTH_CHECK, 0);
+        healthCheck.isActive = 0;
+    }
+}
+
+int
+evrHealthStatus(void)
+{
+    return healthCheck.status;
+}
+
+
+/*
+ * Called from main loop
+ */
+void
+evrCrank(void)
+{
+    int i;
+
+    for (i = 0 ; i < EVR_CRANK_EVENT_LIMIT ; i++) {
+        const struct evrEvent *ep = logEventFromFIFO();
+        if (ep == NULL) {
+            break;
+        }
+        if (healthCheck.isActive) {
+            healthCheckEvent(ep);
+        }
+    }
+    if (healthCheck.isActive) {
+        healthCheckCrank();
+    }
+}
+
 void
 evrInit(void)
 {
     int t;
-    uint32_t then;
-    int firstEvent0 = 1;
 
     /*
      * Generate and remove reset
@@ -73,42 +318,6 @@ evrInit(void)
      */
     Xil_Out32(EVR_REG(17), EVR_REG17_DB_DISABLE);
 
-    /*
-     * Confirm that heartbeat and PPS markers are present
-     */
-    heartbeat.count = 0;
-    pps.count = 0;
-    evrSetEventAction(EVENT_HEARTBEAT, EVR_RAM_WRITE_FIFO);
-    evrSetEventAction(EVENT_PPS,       EVR_RAM_WRITE_FIFO);
-    then = MICROSECONDS_SINCE_BOOT();
-    for (;;) {
-        if ((Xil_In32(EVR_REG(28)) & 0x1) == 0) {
-            unsigned int seconds = Xil_In32(EVR_REG(29));
-            unsigned int fraction = Xil_In32(EVR_REG(30));
-            int eventCode = Xil_In32(EVR_REG(31));
-            switch(eventCode) {
-            case EVENT_HEARTBEAT: evGot(&heartbeat); break;
-            case EVENT_PPS:       evGot(&pps);       break;
-            default:
-                /*
-                 * For unknown reasons the event receiver often (always?)
-                 * emits a spurious event 0 on startup.
-                 */
-                if ((eventCode == 0) && firstEvent0) {
-                    firstEvent0 = 0;
-                    break;
-                }
-                printf("Warning -- Unexpected event %d (seconds/fraction:%d/%d)\n",
-                                                    eventCode, seconds, fraction);
-                break;
-            }
-        }
-        if (((uint32_t)(MICROSECONDS_SINCE_BOOT() - then) > 6000000)
-         || ((heartbeat.count >= 2) && (pps.count >= 2))) break;
-    }
-    evChk("Heartbeat", &heartbeat);
-    evChk("PPS", &pps);
-
     /*
      * Trigger 0 is the heartbeat event marker used
      * to synchronize the SROC reference generation.
@@ -117,7 +326,6 @@ evrInit(void)
      */
     evrSetTriggerDelay(0, 1);
     evrSetTriggerWidth(0, 125000000 / 4);
-    evrSetEventAction(EVENT_HEARTBEAT, EVR_RAM_TRIGGER_0);
 
     /*
      * Trigger 1 is a 1 pulse per second (exactly) marker.
@@ -126,7 +334,6 @@ evrInit(void)
      */
     evrSetTriggerDelay(1, 1);
     evrSetTriggerWidth(1, 125000000 / 4);
-    evrSetEventAction(EVENT_PPS, EVR_RAM_TRIGGER_1);
 
     /*
      * Remaining triggers are available as ADC recorder event triggers.
@@ -138,6 +345,20 @@ evrInit(void)
         evrSetTriggerDelay(t, 1);
         evrSetTriggerWidth(t, 12500000);
     }
+
+    /*
+     * Log heartbeat and PPS markers until health check completes
+     */
+    heartbeat.count = 0;
+    pps.count = 0;
+    healthCheck.firstEvent0 = 1;
+    healthCheck.status = 0;
+    healthCheck.whenStarted = MICROSECONDS_SINCE_BOOT();
+    healthCheck.isActive = 1;
+    evrSetEventAction(EVENT_HEARTBEAT, EVR_RAM_TRIGGER_0);
+    evrSetEventAction(EVENT_PPS,       EVR_RAM_TRIGGER_1);
+    setFifoOwner(EVENT_HEARTBEAT, FIFO_OWNER_HEALTH_CHECK, 1);
+    setFifoOwner(EVENT_PPS,       FIFO_OWNER_HEALTH_CHECK, 1);
 }
 
 void
@@ -154,7 +375,7 @@ evrShow(void)
                                 (csr & EVR_REG17_DB_DISABLE) ? "dis" : "en");
     printf("   RAM %s active.\n", (csr & 0x1) ? "B" : "A");
     for (i = 0 ; i < EVR_EVENT_COUNT ; i++) {
-        action = evrGetEventAction(i);
+        action = readAction(i);
         if (action) {
             int b;
             actionPresent |= action;
@@ -193,6 +414,15 @@ evrShow(void)
         printf("    Too few seconds codes: %d\n", evrNtooFewSecondEvents());
     if (evrNtooManySecondEvents())
         printf("   Too many seconds codes: %d\n", evrNtooManySecondEvents());
+    if (healthCheck.isActive) {
+        printf("   Heartbeat/PPS check in progress.\n");
+    }
+    else {
+        printf("   Heartbeat %s, PPS %s.\n",
+              (healthCheck.status & EVR_HEALTH_HEARTBEAT_OK) ? "good" : "bad",
+              (healthCheck.status & EVR_HEALTH_PPS_OK) ? "good" : "bad");
+    }
+    showEventLog(10);
     evrCurrentTime(&ts);
     printf("EVR seconds:fraction  %d:%09d\n", ts.secPastEpoch, ts.fraction);
 }
@@ -235,16 +465,21 @@ evrSetTriggerWidth(unsigned int triggerNumber, int ticks)
         Xil_Out32(EVR_WIDTH(triggerNumber), ticks);
 }
 
+/*
+ * Events that trigger acquisitions are logged
+ */
 void
 evrSetEventAction(unsigned int eventNumber, int action)
 {
-    unsigned int csr = Xil_In32(EVR_REG(17));
-    unsigned int addr;
+    int owners;
 
     if (eventNumber < EVR_EVENT_COUNT) {
-        addr = (csr & EVR_REG17_BANK_B) ? EVR_RAM_B(eventNumber) :
-                                          EVR_RAM_A(eventNumber);
-        Xil_Out32(addr, (Xil_In32(addr) & ~0xFFFF) | (action & 0xFFFF));
+        owners = fifoOwners[eventNumber] &
+                          ~(FIFO_OWNER_CALLER | FIFO_OWNER_ACQUISITION);
+        if (action & EVR_RAM_WRITE_FIFO) owners |= FIFO_OWNER_CALLER;
+        if (action & EVR_ACQUISITION_TRIGGERS) owners |= FIFO_OWNER_ACQUISITION;
+        fifoOwners[eventNumber] = owners;
+        writeAction(eventNumber, action);
     }
 }
 
@@ -260,19 +495,20 @@ evrRemoveEventAction(unsigned int eventNumber, int action)
     evrSetEventAction(eventNumber, ~action & evrGetEventAction(eventNumber));
 }
 
+/*
+ * Return actions as set by evrSetEventAction, without any
+ * FIFO write action added for logging
+ */
 int
 evrGetEventAction(unsigned int eventNumber)
 {
-    unsigned int csr = Xil_In32(EVR_REG(17));
-    unsigned int addr;
-    int action = 0;
+    int action = readAction(eventNumber);
 
-    if (eventNumber < EVR_EVENT_COUNT) {
-        addr = (csr & EVR_REG17_BANK_B) ? EVR_RAM_B(eventNumber) :
-                                          EVR_RAM_A(eventNumber);
-        action = Xil_In32(addr);
+    if ((eventNumber < EVR_EVENT_COUNT)
+     && !(fifoOwners[eventNumber] & FIFO_OWNER_CALLER)) {
+        action &= ~EVR_RAM_WRITE_FIFO;
     }
-    return action & 0xFFFF;
+    return action;
 }
 
 unsigned int
@@ -29,8 +29,15 @@ typedef struct evrTimestamp {
     uint32_t fraction;
 } evrTimestamp;
 
+#define EVR_HEALTH_CHECKED          0x1
+#define EVR_HEALTH_HEARTBEAT_OK     0x2
+#define EVR_HEALTH_PPS_OK           0x4
+
 void evrInit(void);
+int evrHealthStatus(void);
+void evrCrank(void);
 void evrShow(void);
+int evrFetchEventLog(uint32_t *buf, int capacity, uint32_t first);
 
 void evrCurrentTime(evrTimestamp *);
 
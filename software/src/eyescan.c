@@ -9,11 +9,14 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include "drp.h"
 #include "eyescan.h"
+#include "ffs.h"
 #include "gpio.h"
 #include "util.h"
 
 #define PRESCALE_CODE   5
+#define COARSE_STEP     8
 #define H_LAST          16
 #define V_RANGE         128
 #define V_STRIDE        8
@@ -74,75 +77,16 @@ static struct hOffsetModifier {
     uint16_t augment;
 } hOffsetModifiers[EYESCAN_LANECOUNT];
 
+#if ((2 * H_LAST) % COARSE_STEP) || (((2 * V_RANGE) / V_STRIDE) % COARSE_STEP)
+# error "Coarse grid must span scan range"
+#endif
+
 static enum eyescanFormat {
     FMT_ASCII_ART,
     FMT_NUMERIC,
     FMT_RAW
 } eyescanFormat;
 
-static void
-drp_eyescan_reset(int lane, int reset)
-{
-    GPIO_WRITE(GPIO_IDX_EVR_GTY_DRP+lane, (1UL << 30) | (reset != 0));
-}
-
-static void
-drp_write(int lane, int regOffset, int value)
-{
-    int pass = 0;
-    GPIO_WRITE(GPIO_IDX_EVR_GTY_DRP+lane,
-                            (1UL << 31) | (regOffset << 16) | (value & 0xFFFF));
-    if (debugFlags & DEBUGFLAG_DRP) {
-        printf("%x:%04x <- %04X\n", lane, regOffset, value);
-    }
-    while(GPIO_READ(GPIO_IDX_EVR_GTY_DRP+lane) & (1UL << 31)) {
-        if (++pass == 10) {
-            printf("Lane %d, reg 0x%x drp_write failed.\n", lane, regOffset);
-            return;
-        }
-    }
-}
-
-static int
-drp_read(int lane, int regOffset)
-{
-    int pass = 0;
-    uint32_t drp;
-
-    GPIO_WRITE(GPIO_IDX_EVR_GTY_DRP+lane, regOffset << 16);
-    while((drp = GPIO_READ(GPIO_IDX_EVR_GTY_DRP+lane)) & (1UL << 31)) {
-        if (++pass == 10) {
-            printf("Lane %d, reg 0x%x drp_read failed.\n", lane, regOffset);
-            return 0;
-        }
-    }
-    if (debugFlags & DEBUGFLAG_DRP) {
-        printf("%x:%04x -> %04X\n", lane, regOffset, drp & 0xFFFF);
-    }
-    return drp & 0xFFFF;
-}
-
-static void
-drp_rmw(int lane, int regOffset, int mask, int value)
-{
-    uint16_t v = drp_read(lane, regOffset);
-    v &= ~mask;
-    v |= value & mask;
-    drp_write(lane, regOffset, v);
-}
-
-static void
-drp_set(int lane, int regOffset, int bits)
-{
-    drp_rmw(lane, regOffset, bits, bits);
-}
-
-static void
-drp_clr(int lane, int regOffset, int bits)
-{
-    drp_rmw(lane, regOffset, bits, 0);
-}
-
 static void
 drp_showReg(int lane, const char *msg)
 {
@@ -154,7 +98,7 @@ drp_showReg(int lane, const char *msg)
     printf("\nLANE %d DRP REGISTERS (%s):\n", lane, msg);
     for (i = 0 ; i < sizeof base / sizeof base[0] ; i++) {
         for (r = base[i] ; r <= last[i] ; r++) {
-            printf("%s%03X:%04X", c ? "    " : "", r, drp_read(lane, r));
+            printf("%s%03X:%04X", c ? "    " : "", r, drpRead(lane, r));
             if (++c == 6) {
                 printf("\n");
                 c = 0;
@@ -182,46 +126,48 @@ eyescanInit(void)
     printf("Device revision %d.  %s eye scan code.\n", deviceRevision,
             isProductionSilicon ? "Production silicon" : "Engineering sample");
     for (lane = 0 ; lane < EYESCAN_LANECOUNT ; lane++) {
+        drpBegin(lane);
+
         /* Enable statistical eye scan */
-        drp_write(lane, DRP_REG_ES_CONTROL, ES_CONTROL_ERRDET_ENABLE |
+        drpWrite(lane, DRP_REG_ES_CONTROL, ES_CONTROL_ERRDET_ENABLE |
                                             ES_CONTROL_EYE_SCAN_ENABLE |
                                             PRESCALE_CODE);
 
         /* Set ES_SDATA_MASK to check configured N bit data */
-        drp_write(lane, DRP_REG_ES_SDATA_MASK0, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_SDATA_MASK1, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_SDATA_MASK2, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_SDATA_MASK3, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_SDATA_MASK4, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_SDATA_MASK5, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_SDATA_MASK6, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_SDATA_MASK7, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_SDATA_MASK8, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_SDATA_MASK9, 0xFFFF);
-        switch (drp_read(lane, DRP_REG_RX_WIDTH) >> 5 & 0x7) {
+        drpWrite(lane, DRP_REG_ES_SDATA_MASK0, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_SDATA_MASK1, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_SDATA_MASK2, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_SDATA_MASK3, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_SDATA_MASK4, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_SDATA_MASK5, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_SDATA_MASK6, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_SDATA_MASK7, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_SDATA_MASK8, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_SDATA_MASK9, 0xFFFF);
+        switch (drpRead(lane, DRP_REG_RX_WIDTH) >> 5 & 0x7) {
         case 3: // 20 bit
-            drp_write(lane, DRP_REG_ES_SDATA_MASK3, 0x0FFF);
-            drp_write(lane, DRP_REG_ES_SDATA_MASK4, 0x0000);
+            drpWrite(lane, DRP_REG_ES_SDATA_MASK3, 0x0FFF);
+            drpWrite(lane, DRP_REG_ES_SDATA_MASK4, 0x0000);
             break;
 
         case 5: // 40 bit
-            drp_write(lane, DRP_REG_ES_SDATA_MASK2, 0x00FF);
-            drp_write(lane, DRP_REG_ES_SDATA_MASK3, 0x0000);
-            drp_write(lane, DRP_REG_ES_SDATA_MASK4, 0x0000);
+            drpWrite(lane, DRP_REG_ES_SDATA_MASK2, 0x00FF);
+            drpWrite(lane, DRP_REG_ES_SDATA_MASK3, 0x0000);
+            drpWrite(lane, DRP_REG_ES_SDATA_MASK4, 0x0000);
             break;
         }
 
         /* Enable all bits in ES_QUAL_MASK (count all bits) */
-        drp_write(lane, DRP_REG_ES_QUAL_MASK0, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_QUAL_MASK1, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_QUAL_MASK2, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_QUAL_MASK3, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_QUAL_MASK4, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_QUAL_MASK5, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_QUAL_MASK6, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_QUAL_MASK7, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_QUAL_MASK8, 0xFFFF);
-        drp_write(lane, DRP_REG_ES_QUAL_MASK9, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_QUAL_MASK0, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_QUAL_MASK1, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_QUAL_MASK2, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_QUAL_MASK3, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_QUAL_MASK4, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_QUAL_MASK5, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_QUAL_MASK6, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_QUAL_MASK7, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_QUAL_MASK8, 0xFFFF);
+        drpWrite(lane, DRP_REG_ES_QUAL_MASK9, 0xFFFF);
 
         if (isProductionSilicon) {
             hOffsetModifiers[lane].mask = 0x7FF;
@@ -240,53 +186,74 @@ eyescanInit(void)
             hOffsetModifiers[lane].mask = 0xFFF;
             hOffsetModifiers[lane].augment = 0;
         }
-        drp_rmw(lane, DRP_REG_ES_PHASE_CONFIG,
+        drpRMW(lane, DRP_REG_ES_PHASE_CONFIG,
                     ES_PHASE_CONFIG_USE_PCS_CLK_PHASE_SEL, esPhaseChangeConfig);
+        drpEnd(lane);
     }
 }
 
+/*
+ * Scan results, row 0 is the top (+V_RANGE) of the eye
+ * and column 0 the left (-hRange) edge.
+ * Results remain available for export until the next scan of the lane.
+ *
+ * An adaptive scan measures every COARSE_STEP'th point with a short dwell
+ * then repeatedly halves the step, measuring with successively longer
+ * dwell only those points within cells whose corners disagree.
+ */
+#define H_COUNT ((2 * H_LAST) + 1)
+#define V_COUNT (((2 * V_RANGE) / V_STRIDE) + 1)
+static struct eyescanLane {
+    enum { LANE_IDLE, LANE_SYNC, LANE_SYNC_WAIT, LANE_SETUP, LANE_ACQUIRING,
+           LANE_DONE, LANE_FAILED }
+                    state;
+    int             syncPass;
+    int             hRange;
+    int             hStride;
+    int             hIndex;
+    int             vIndex;
+    int             step;
+    int             isAdaptive;
+    uint32_t        whenStarted;
+    uint32_t        whenScanStarted;
+    uint32_t        sequence;
+    int             haveResults;
+    int             pointCount;
+    struct eyescanPoint points[V_COUNT][H_COUNT];
+} eyescanLanes[EYESCAN_LANECOUNT];
+
+/*
+ * Scans run on all selected lanes at once.
+ * Results are printed after all lanes have completed.
+ */
+static int eyescanActive, eyescanPrinting;
+static int printLane, printRow;
+
 /*
  * 2 characters for each point except the first.
  * (-H_LAST to -1, 0 +1 to +H_LAST) points.
  */
 #define PLOT_WIDTH ((((2 * H_LAST) + 1) * 2) - 1)
-static int
-xBorderCrank(int lane)
+static void
+printBorder(int lane)
 {
     const int titleOffset = 2;
-    static int i = PLOT_WIDTH + 1, nameIndex, laneIndex;
-    char c;
-
-    if (eyescanFormat == FMT_RAW) return 0;
-    if (lane >= 0) {
-        i = -1;
-        nameIndex = 0;
-        laneIndex = lane;
-    }
-    if (i <= PLOT_WIDTH) {
-        if (i == -1) {
+    const char *name = laneNames[lane];
+    int i;
+
+    printf("+");
+    for (i = 0 ; i < PLOT_WIDTH ; i++) {
+        if (i == PLOT_WIDTH / 2) {
             printf("+");
         }
-        else if (i == PLOT_WIDTH) {
-                printf("+\n");
+        else if ((i >= titleOffset) && (*name != '\0')) {
+            printf("%c", *name++);
         }
         else {
-            if (i == PLOT_WIDTH / 2) {
-                c = '+';
-            }
-            else if ((laneIndex < EYESCAN_LANECOUNT)
-                  && (i >= titleOffset)
-                  && (laneNames[laneIndex][nameIndex] != '\0')) {
-                c = laneNames[laneIndex][nameIndex++];
-            }
-            else {
-                c = '-';
-            }
-            printf("%c", c);
+            printf("-");
         }
-        i++;
     }
-    return (i <= PLOT_WIDTH);
+    printf("+\n");
 }
 
 /*
@@ -315,148 +282,478 @@ plotChar(int errorCount)
 }
 
 /*
- * Perform an acquisition at 0 offset to see if synchronization is right
+ * Convert scan indices to offsets
  */
 static int
-eyescanSync(int lane)
+hOffsetAt(struct eyescanLane *lp, int hIndex)
 {
-    int pass;
-    uint32_t whenStarted;
-
-    drp_rmw(lane, DRP_REG_ES_VERT_CONTROL, 0x7FC, 0);
-    drp_rmw(lane, DRP_REG_ES_HORZ_OFFSET, 0xFFF0, 0);
-    for (pass = 0 ; pass < 10 ; pass++) {
-        whenStarted = MICROSECONDS_SINCE_BOOT();
-        drp_set(lane, DRP_REG_ES_CONTROL, ES_CONTROL_RUN);
-        for (;;) {
-            if (drp_read(lane, DRP_REG_ES_STATUS) & ES_STATUS_DONE) {
-                if (drp_read(lane, DRP_REG_ES_ERROR_COUNT) < 65535) {
-                if (pass) {
-                    printf("Lane %d synchronized after pass %d.\n", lane, pass);
-                }
-                    return 1;
-                }
-                break;
-            }
-            if ((int32_t)(MICROSECONDS_SINCE_BOOT() - whenStarted) > 500000) {
-                drp_clr(lane, DRP_REG_ES_CONTROL, ES_CONTROL_RUN);
-                return 0;
+    return -lp->hRange + (hIndex * lp->hStride);
+}
+
+static int
+vOffsetAt(int vIndex)
+{
+    return V_RANGE - (vIndex * V_STRIDE);
+}
+
+#define isMeasured(pp) ((pp)->sampleCount != 0)
+
+/*
+ * Error count scaled to that of a full-length dwell
+ */
+static int
+scaledErrorCount(const struct eyescanPoint *pp)
+{
+    int errorCount = pp->errorCount << (PRESCALE_CODE - pp->prescale);
+    return errorCount > 65535 ? 65535 : errorCount;
+}
+
+/*
+ * Find the nearest measured point above and to the left
+ * that was part of the grid from which this point was skipped.
+ */
+static const struct eyescanPoint *
+measuredPoint(struct eyescanLane *lp, int v, int h)
+{
+    int s;
+
+    for (s = 1 ; s <= COARSE_STEP ; s *= 2) {
+        const struct eyescanPoint *pp = &lp->points[v - (v % s)][h - (h % s)];
+        if (isMeasured(pp)) return pp;
+    }
+    return NULL;
+}
+
+/*
+ * Print one row of results
+ */
+static void
+printRowOfLane(int lane, int row)
+{
+    struct eyescanLane *lp = &eyescanLanes[lane];
+    int vOffset = vOffsetAt(row);
+    char border = vOffset == 0 ? '+' : '|';
+    int h;
+
+    for (h = 0 ; h < H_COUNT ; h++) {
+        const struct eyescanPoint *pp = &lp->points[row][h];
+        int errorCount;
+        int hOffset = hOffsetAt(lp, h);
+        if (eyescanFormat == FMT_RAW) {
+            if (isMeasured(pp)) {
+                printf("%4d %4d %6d\n", pp->hOffset, pp->vOffset,
+                                                        scaledErrorCount(pp));
             }
         }
-        /*
-         * Attempt resynchronization as described in AR#68785
-         */
-        drp_rmw(lane, DRP_REG_ES_HORZ_OFFSET, 0xFFF0, 0x880 << 4);
-        microsecondSpin(1);
-        drp_eyescan_reset(lane, 1);
-        drp_rmw(lane, DRP_REG_ES_HORZ_OFFSET, 0xFFF0, 0x800 << 4);
-        drp_eyescan_reset(lane, 0);
+        else {
+            pp = measuredPoint(lp, row, h);
+            errorCount = pp ? scaledErrorCount(pp) : 65535;
+            char c;
+            printf("%c", (h == 0) ? border : ' ');
+            if ((errorCount == 0) && (hOffset == 0) && (vOffset == 0))
+                c = '+';
+            else
+                c = plotChar(errorCount);
+            printf("%c", c);
+        }
+    }
+    if (eyescanFormat != FMT_RAW) {
+        printf("%c\n", border);
+    }
+}
+
+/*
+ * Print results a line at a time to avoid swamping the console
+ */
+static int
+printCrank(void)
+{
+    for (;;) {
+        if (printLane >= EYESCAN_LANECOUNT) {
+            return 0;
+        }
+        if (eyescanLanes[printLane].state == LANE_DONE) {
+            break;
+        }
+        printLane++;
+        printRow = -1;
+    }
+    if (printRow < 0) {
+        if (eyescanFormat != FMT_RAW) {
+            struct eyescanLane *lp = &eyescanLanes[printLane];
+            printf("Lane %d: %d points in %d ms.\n", printLane, lp->pointCount,
+                    (int)(lp->whenStarted - lp->whenScanStarted) / 1000);
+            printBorder(printLane);
+        }
+    }
+    else if (printRow >= V_COUNT) {
+        if (eyescanFormat != FMT_RAW) {
+            printBorder(printLane);
+        }
+    }
+    else {
+        printRowOfLane(printLane, printRow);
+    }
+    if (++printRow > V_COUNT) {
+        eyescanLanes[printLane].state = LANE_IDLE;
+        printLane++;
+        printRow = -1;
+    }
+    return 1;
+}
+
+/*
+ * Prepare a lane for scanning.
+ * Synchronization is checked by eyescanStep before the first point.
+ */
+static void
+eyescanStart(int lane, int isAdaptive)
+{
+    struct eyescanLane *lp = &eyescanLanes[lane];
+
+    /* Want H_LAST horizontal points on either side of baseline */
+    int rxDiv = 1 << (drpRead(lane, DRP_REG_RX_CONFIG) & RX_CONFIG_RX_DIV_MASK);
+    lp->hRange = 32 * rxDiv;
+    lp->hStride = lp->hRange / H_LAST;
+    lp->hIndex = 0;
+    lp->vIndex = 0;
+    lp->isAdaptive = isAdaptive;
+    lp->step = isAdaptive ? COARSE_STEP : 1;
+    lp->haveResults = 0;
+    lp->pointCount = 0;
+    memset(lp->points, 0, sizeof lp->points);
+    drpRMW(lane, DRP_REG_ES_CONTROL, ES_CONTROL_PRESCALE_MASK, PRESCALE_CODE);
+    lp->whenScanStarted = MICROSECONDS_SINCE_BOOT();
+    drpRMW(lane, DRP_REG_ES_VERT_CONTROL, 0x7FC, 0);
+    drpRMW(lane, DRP_REG_ES_HORZ_OFFSET, 0xFFF0, 0);
+    lp->syncPass = 0;
+    lp->state = LANE_SYNC;
+}
+
+/*
+ * Check whether points within cell disagree.
+ * A cell with any corner not yet measured was not itself refined.
+ */
+static int
+cellIsBoundary(struct eyescanLane *lp, int v, int h, int size)
+{
+    int i, class, firstClass = 0;
+
+    for (i = 0 ; i < 4 ; i++) {
+        const struct eyescanPoint *pp = &lp->points[v + ((i & 2) ? size : 0)]
+                                                   [h + ((i & 1) ? size : 0)];
+        if (!isMeasured(pp)) return 0;
+        if (pp->errorCount == 0)          class = 0;
+        else if (pp->errorCount >= 65535) class = 2;
+        else                              class = 1;
+        if (class == 1) return 1;
+        if (i == 0) firstClass = class;
+        else if (class != firstClass) return 1;
     }
-    printf("Lane %d eye scan did not synchronize.\n", lane);
     return 0;
 }
 
+/*
+ * Check whether a point must be measured at the lane's current step
+ */
 static int
-eyescanStep(int lane)
+pointIsNeeded(struct eyescanLane *lp, int v, int h)
 {
-    static int eyescanActive, eyescanAcquiring, eyescanLane;
-    static int hRange, hStride;
-    static int hOffset, vOffset;
-    static int errorCount;
-    static int activeLane;
-    static uint32_t whenStarted;
-
-    if ((lane >= 0) && !eyescanActive) {
-        /* Want H_LAST horizontal points on either side of baseline */
-        int rxDiv = 1 << (drp_read(lane, DRP_REG_RX_CONFIG) & 0x7);
-        hRange = 32 * rxDiv; 
-        hStride = hRange / H_LAST;
-        hOffset = -hRange;
-        vOffset = V_RANGE;
-        if (!eyescanSync(lane)) {
+    int size = lp->step * 2;
+    int vc, hc;
+
+    if (isMeasured(&lp->points[v][h])) return 0;
+    if (!lp->isAdaptive || (lp->step == COARSE_STEP)) return 1;
+    for (vc = v - size ; vc <= v ; vc += lp->step) {
+        if ((vc < 0) || (vc % size) || ((vc + size) >= V_COUNT)) continue;
+        for (hc = h - size ; hc <= h ; hc += lp->step) {
+            if ((hc < 0) || (hc % size) || ((hc + size) >= H_COUNT)) continue;
+            if (cellIsBoundary(lp, vc, hc, size)) return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Move to next point needing measurement.
+ * Return 0 if there are no more points.
+ */
+static int
+advanceToNeededPoint(struct eyescanLane *lp)
+{
+    for (;;) {
+        while (lp->vIndex < V_COUNT) {
+            if (pointIsNeeded(lp, lp->vIndex, lp->hIndex)) {
+                return 1;
+            }
+            lp->hIndex += lp->step;
+            if (lp->hIndex >= H_COUNT) {
+                lp->hIndex = 0;
+                lp->vIndex += lp->step;
+            }
+        }
+        if (lp->step == 1) {
             return 0;
         }
-        xBorderCrank(lane);
-        eyescanLane = lane;
-        eyescanAcquiring = 0;
-        eyescanActive = 1;
-        activeLane = lane;
-        return 1;
+        lp->step /= 2;
+        lp->hIndex = 0;
+        lp->vIndex = 0;
     }
-    if (xBorderCrank(-1)) {
-        return 1;
+}
+
+/*
+ * Dwell is shortened by 2x for each doubling of the step
+ */
+static int
+prescaleForStep(int step)
+{
+    int prescale = PRESCALE_CODE;
+
+    while ((step > 1) && (prescale > 0)) {
+        step /= 2;
+        prescale--;
     }
-    if (eyescanActive) {
-        if (eyescanAcquiring) {
-            int status = drp_read(activeLane, DRP_REG_ES_STATUS);
-            if ((status & ES_STATUS_DONE)
-             || ((int32_t)(MICROSECONDS_SINCE_BOOT() - whenStarted) > 500000)) {
-                eyescanAcquiring = 0;
-                if (status & ES_STATUS_DONE) {
-                    char border = vOffset == 0 ? '+' : '|';
-                    errorCount = drp_read(activeLane, DRP_REG_ES_ERROR_COUNT);
-                    if (eyescanFormat == FMT_RAW) {
-                        int h;
-                        int v;
-                        h = drp_read(activeLane, DRP_REG_ES_HORZ_OFFSET);
-                        h = (h >> 4) & 0x7FF;
-                        if (h & 0x400) h -= 0x800;
-                        v = drp_read(activeLane, DRP_REG_ES_VERT_CONTROL);
-                        v = ((v & (1 << 10)) ? -1 : 1) * ((v >> 2) & 0x7F);
-                        printf("%4d %4d %6d\n", h, v, errorCount);
-                    }
-                    else {
-                        char c;
-                        printf("%c", (hOffset == -hRange) ? border : ' ');
-                        if ((errorCount==0) && (hOffset==0) && (vOffset==0))
-                            c = '+';
-                        else
-                            c = plotChar(errorCount);
-                        printf("%c", c);
-                    }
-                    hOffset += hStride;
-                    if (hOffset > hRange) {
-                        if (eyescanFormat != FMT_RAW) {
-                            printf("%c\n", border);
-                        }
-                        hOffset = -hRange;
-                        vOffset -= V_STRIDE;
-                    }
-                }
-                else {
-                    drp_showReg(activeLane, "SCAN FAILURE");
-                    eyescanActive = 0;
+    return prescale;
+}
+
+/*
+ * Advance the scan of a single lane without waiting.
+ * Return 1 if scan is still in progress.
+ */
+static int
+eyescanStep(int lane)
+{
+    struct eyescanLane *lp = &eyescanLanes[lane];
+    int status;
+
+    switch (lp->state) {
+    /*
+     * Perform acquisitions at 0 offset until synchronization is right
+     */
+    case LANE_SYNC:
+        drpSet(lane, DRP_REG_ES_CONTROL, ES_CONTROL_RUN);
+        lp->whenStarted = MICROSECONDS_SINCE_BOOT();
+        lp->state = LANE_SYNC_WAIT;
+        return 1;
+
+    case LANE_SYNC_WAIT:
+        if (drpRead(lane, DRP_REG_ES_STATUS) & ES_STATUS_DONE) {
+            if (drpRead(lane, DRP_REG_ES_ERROR_COUNT) < 65535) {
+                if (lp->syncPass) {
+                    printf("Lane %d synchronized after pass %d.\n", lane,
+                                                                lp->syncPass);
                 }
-                drp_clr(activeLane, DRP_REG_ES_CONTROL, ES_CONTROL_RUN);
+                lp->state = LANE_SETUP;
+                return 1;
             }
-            else if (debugFlags & DEBUGFLAG_DRP) {
-                microsecondSpin(5000);
+            /*
+             * Attempt resynchronization as described in AR#68785
+             */
+            drpRMW(lane, DRP_REG_ES_HORZ_OFFSET, 0xFFF0, 0x880 << 4);
+            microsecondSpin(1);
+            drpReset(lane, 1);
+            drpRMW(lane, DRP_REG_ES_HORZ_OFFSET, 0xFFF0, 0x800 << 4);
+            drpReset(lane, 0);
+            if (++lp->syncPass >= 10) {
+                printf("Lane %d eye scan did not synchronize.\n", lane);
+                lp->state = LANE_FAILED;
+                return 0;
             }
+            lp->state = LANE_SYNC;
         }
-        else if (vOffset < -V_RANGE) {
-            xBorderCrank(eyescanLane);
-            eyescanActive = 0;
+        else if ((int32_t)(MICROSECONDS_SINCE_BOOT() - lp->whenStarted) >
+                                                                      500000) {
+            drpClr(lane, DRP_REG_ES_CONTROL, ES_CONTROL_RUN);
+            lp->state = LANE_FAILED;
+            return 0;
+        }
+        return 1;
+
+    case LANE_SETUP:
+        if (!advanceToNeededPoint(lp)) {
+            lp->whenStarted = MICROSECONDS_SINCE_BOOT();
+            lp->sequence++;
+            lp->haveResults = 1;
+            lp->state = LANE_DONE;
+            return 0;
         }
         else {
+            int vOffset = vOffsetAt(lp->vIndex);
             int vAbs = abs(vOffset);
-            struct hOffsetModifier *hp = &hOffsetModifiers[activeLane];
+            struct hOffsetModifier *hp = &hOffsetModifiers[lane];
+            struct eyescanPoint *pp = &lp->points[lp->vIndex][lp->hIndex];
+            int prescale = prescaleForStep(lp->step);
             if (vAbs > 127) vAbs = 127;
-            drp_rmw(activeLane, DRP_REG_ES_VERT_CONTROL, 0x7FC,
+            pp->hOffset = hOffsetAt(lp, lp->hIndex);
+            pp->vOffset = vOffset < 0 ? -vAbs : vAbs;
+            pp->prescale = prescale;
+            drpBegin(lane);
+            drpRMW(lane, DRP_REG_ES_CONTROL, ES_CONTROL_PRESCALE_MASK,
+                                                                     prescale);
+            drpRMW(lane, DRP_REG_ES_VERT_CONTROL, 0x7FC,
                                    (vOffset < 0 ? (1 << 10) : 0) | (vAbs << 2));
-            drp_rmw(activeLane, DRP_REG_ES_HORZ_OFFSET, 0xFFF0,
-                                     ((hOffset & hp->mask) | hp->augment) << 4);
-            drp_set(activeLane, DRP_REG_ES_CONTROL, ES_CONTROL_RUN);
-            whenStarted = MICROSECONDS_SINCE_BOOT();
-            eyescanAcquiring = 1;
+            drpRMW(lane, DRP_REG_ES_HORZ_OFFSET, 0xFFF0,
+                                ((pp->hOffset & hp->mask) | hp->augment) << 4);
+            drpEnd(lane);
+            drpSet(lane, DRP_REG_ES_CONTROL, ES_CONTROL_RUN);
+            lp->whenStarted = MICROSECONDS_SINCE_BOOT();
+            lp->state = LANE_ACQUIRING;
+        }
+        return 1;
+
+    case LANE_ACQUIRING:
+        status = drpRead(lane, DRP_REG_ES_STATUS);
+        if (status & ES_STATUS_DONE) {
+            struct eyescanPoint *pp = &lp->points[lp->vIndex][lp->hIndex];
+            pp->errorCount = drpRead(lane, DRP_REG_ES_ERROR_COUNT);
+            pp->sampleCount = drpRead(lane, DRP_REG_ES_SAMPLE_COUNT);
+            lp->pointCount++;
+            drpClr(lane, DRP_REG_ES_CONTROL, ES_CONTROL_RUN);
+            lp->hIndex += lp->step;
+            if (lp->hIndex >= H_COUNT) {
+                lp->hIndex = 0;
+                lp->vIndex += lp->step;
+            }
+            lp->state = LANE_SETUP;
+        }
+        else if ((int32_t)(MICROSECONDS_SINCE_BOOT() - lp->whenStarted) >
+                                                                      500000) {
+            drp_showReg(lane, "SCAN FAILURE");
+            drpClr(lane, DRP_REG_ES_CONTROL, ES_CONTROL_RUN);
+            lp->state = LANE_FAILED;
+            return 0;
         }
+        else if (debugFlags & DEBUGFLAG_DRP) {
+            microsecondSpin(5000);
+        }
+        return 1;
+
+    default:
+        return 0;
     }
-    return eyescanActive;
 }
 
+/*
+ * Interleave acquisitions of all lanes being scanned.
+ * While one lane is acquiring the others can be set up or read out.
+ */
 int
 eyescanCrank(void)
 {
-    return eyescanStep(-1);
+    int lane, busy = 0;
+
+    if (eyescanActive) {
+        for (lane = 0 ; lane < EYESCAN_LANECOUNT ; lane++) {
+            busy |= eyescanStep(lane);
+        }
+        if (!busy) {
+            eyescanActive = 0;
+            eyescanPrinting = 1;
+            printLane = 0;
+            printRow = -1;
+        }
+        return 1;
+    }
+    if (eyescanPrinting) {
+        eyescanPrinting = printCrank();
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Fetch results for the IOC
+ *  Word 0: Number of scans completed on the lane
+ *  Word 1: Horizontal point count (15:0), vertical point count (31:16)
+ *  Word 2: Nonzero if adaptive (7:0), measured point count (31:16)
+ *  Then two words per measured point starting at the requested point:
+ *      Horizontal offset (15:0), vertical offset (23:16), prescale (31:24)
+ *      Error count (15:0), sample count (31:16)
+ * Only completed scans are returned.  A scan in progress or one that
+ * failed leaves no results, though word 0 still counts earlier scans.
+ */
+int
+eyescanFetch(uint32_t *buf, int capacity, int lane, int first)
+{
+    struct eyescanLane *lp;
+    const struct eyescanPoint *pp;
+    int i, n = 0;
+
+    if ((lane < 0) || (lane >= EYESCAN_LANECOUNT) || (capacity < 3)) {
+        return 0;
+    }
+    lp = &eyescanLanes[lane];
+    *buf++ = lp->sequence;
+    *buf++ = (V_COUNT << 16) | H_COUNT;
+    if (!lp->haveResults) {
+        *buf++ = 0;
+        return 3;
+    }
+    *buf++ = (lp->pointCount << 16) | lp->isAdaptive;
+    n = 3;
+    pp = &lp->points[0][0];
+    for (i = 0 ; (i < (V_COUNT * H_COUNT)) && ((n + 2) <= capacity) ; i++) {
+        if (isMeasured(pp) && (first-- <= 0)) {
+            *buf++ = ((uint32_t)pp->prescale << 24) |
+                     ((uint8_t)pp->vOffset << 16) | (uint16_t)pp->hOffset;
+            *buf++ = ((uint32_t)pp->sampleCount << 16) | pp->errorCount;
+            n += 2;
+        }
+        pp++;
+    }
+    return n;
+}
+
+/*
+ * Write results of all completed scans to a file for TFTP transfer.
+ * Each lane is a struct eyescanFileHeader followed by
+ * the struct eyescanPoint values, little-endian.
+ */
+int
+eyescanFetchFile(void)
+{
+    FRESULT fr;
+    FIL fil;
+    UINT nWritten;
+    int lane, i, total = 0;
+    struct eyescanFileHeader header;
+
+    fr = f_open(&fil, "/"EYESCAN_FILE_NAME, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        return -1;
+    }
+    for (lane = 0 ; lane < EYESCAN_LANECOUNT ; lane++) {
+        struct eyescanLane *lp = &eyescanLanes[lane];
+        if (!lp->haveResults) {
+            continue;
+        }
+        header.magic = EYESCAN_FILE_MAGIC;
+        header.lane = lane;
+        header.isAdaptive = lp->isAdaptive;
+        header.sequence = lp->sequence;
+        header.pointCount = lp->pointCount;
+        fr = f_write(&fil, &header, sizeof header, &nWritten);
+        if ((fr != FR_OK) || (nWritten != sizeof header)) {
+            total = -1;
+            break;
+        }
+        total += nWritten;
+        for (i = 0 ; i < (V_COUNT * H_COUNT) ; i++) {
+            const struct eyescanPoint *pp = &lp->points[0][0] + i;
+            if (!isMeasured(pp)) continue;
+            fr = f_write(&fil, pp, sizeof *pp, &nWritten);
+            if ((fr != FR_OK) || (nWritten != sizeof *pp)) {
+                total = -1;
+                break;
+            }
+            total += nWritten;
+        }
+        if (total < 0) break;
+    }
+    if (f_close(&fil) != FR_OK) {
+        return -1;
+    }
+    return total;
 }
 
 int
@@ -466,16 +763,19 @@ eyescanCommand(int argc, char **argv)
     char *endp;
     enum eyescanFormat format = FMT_ASCII_ART;
     int lane = -1;
+    int isAdaptive = 0;
 
     if (argc == 0) {
         for (i = 0 ; i < EYESCAN_LANECOUNT ; i++) {
             drp_showReg(i, "CMD");
         }
+        drpShowStatistics();
         return 0;
     }
     for (i = 1 ; i < argc ; i++) {
         if (argv[i][0] == '-') {
             switch (argv[i][1]) {
+            case 'a': isAdaptive = 1;         break;
             case 'n': format = FMT_NUMERIC;   break;
             case 'r': format = FMT_RAW;       break;
             default: return 1;
@@ -488,8 +788,14 @@ eyescanCommand(int argc, char **argv)
                 return 1;
         }
     }
-    if (lane < 0) lane = 0;
+    if (eyescanActive || eyescanPrinting) return 0;
     eyescanFormat = format;
-    eyescanStep(lane);
+    for (i = 0 ; i < EYESCAN_LANECOUNT ; i++) {
+        eyescanLanes[i].state = LANE_IDLE;
+        if ((lane < 0) || (lane == i)) {
+            eyescanStart(i, isAdaptive);
+            eyescanActive = 1;
+        }
+    }
     return 0;
 }
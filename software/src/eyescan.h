@@ -8,14 +8,46 @@
 #ifndef _EYESCAN_H_
 #define _EYESCAN_H_
 
+#include <stdint.h>
+
 /*
  * Set this to the comma-separated list of GTY names for your application.
  * Set the first character of a name to '>' for lanes greater than 10 Gb/s.
  */
 #define EYESCAN_LANE_NAMES { "EVR" }
 
+/*
+ * Binary scan results, also available by TFTP as EYESCAN_FILE_NAME.
+ * The file contains, for each lane with a completed scan, a header
+ * followed by pointCount measured points in row-major order from top left.
+ * An adaptive scan omits points away from the eye boundary.
+ * Bit error ratio at a point is
+ *   errorCount / (sampleCount * 2^(1+prescale) * data width)
+ * All values are little-endian, so the file begins with "EYE1".
+ */
+#define EYESCAN_FILE_NAME   "EYESCAN.bin"
+#define EYESCAN_FILE_MAGIC  0x31455945  /* "EYE1" as stored */
+
+struct eyescanFileHeader {
+    uint32_t    magic;
+    uint8_t     lane;
+    uint8_t     isAdaptive;
+    uint16_t    pointCount;
+    uint32_t    sequence;
+};
+
+struct eyescanPoint {
+    int16_t     hOffset;
+    int8_t      vOffset;
+    uint8_t     prescale;
+    uint16_t    errorCount;
+    uint16_t    sampleCount;
+};
+
 void eyescanInit(void);
 int eyescanCrank(void);
 int eyescanCommand (int argc, char **argv);
+int eyescanFetch(uint32_t *buf, int capacity, int lane, int first);
+int eyescanFetchFile(void);
 
 #endif /* _EYESCAN_H_ */
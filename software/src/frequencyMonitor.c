@@ -1,3 +1,9 @@
+/*
+ * Frequency monitor
+ * All channels are swept periodically into a cache so that readers
+ * don't wait on the hardware.  A sliding window of readings from
+ * each channel provides minimum, maximum and standard deviation.
+ */
 #include <stdio.h>
 #include "frequencyMonitor.h"
 #include "gpio.h"
@@ -5,6 +11,23 @@
 
 #define EVR_SYNC_CSR_PPS_VALID 0x4
 
+#define SWEEP_INTERVAL_US   1000000
+#define WINDOW_INTERVAL_US  16000000    /* Hardware update interval with PPS */
+#define WINDOW_SIZE         16
+
+static struct frequencyMonitorChannel {
+    unsigned int latest;
+    unsigned int window[WINDOW_SIZE];
+} channels[FREQUENCY_MONITOR_CHANNEL_COUNT];
+
+static struct frequencyMonitorSweep {
+    uint32_t     whenSwept;
+    uint32_t     whenWindowed;
+    uint32_t     sweepCount;
+    int          windowHead;
+    int          windowCount;
+} sweep;
+
 int
 frequencyMonitorUsingPPS(void)
 {
@@ -17,8 +40,8 @@ frequencyMonitorUsingPPS(void)
  * Go through some contortions to avoid floating point arithmetic when
  * PPS is missing and hence reference interval is SYSCLK / (1 << 27).
  */
-unsigned int
-frequencyMonitorGet(unsigned int channel)
+static unsigned int
+measure(unsigned int channel)
 {
     unsigned int rate;
     GPIO_WRITE(GPIO_IDX_FREQ_MONITOR_CSR, channel);
@@ -29,3 +52,114 @@ frequencyMonitorGet(unsigned int channel)
     }
     return rate;
 }
+
+/*
+ * Refresh cache from main loop
+ */
+void
+frequencyMonitorCrank(void)
+{
+    unsigned int channel;
+    uint32_t now = MICROSECONDS_SINCE_BOOT();
+
+    if ((sweep.sweepCount != 0)
+     && ((now - sweep.whenSwept) < SWEEP_INTERVAL_US)) {
+        return;
+    }
+    sweep.whenSwept = now;
+    sweep.sweepCount++;
+    for (channel = 0 ; channel < FREQUENCY_MONITOR_CHANNEL_COUNT ; channel++) {
+        channels[channel].latest = measure(channel);
+    }
+    if ((sweep.windowCount != 0)
+     && ((now - sweep.whenWindowed) < WINDOW_INTERVAL_US)) {
+        return;
+    }
+    sweep.whenWindowed = now;
+    for (channel = 0 ; channel < FREQUENCY_MONITOR_CHANNEL_COUNT ; channel++) {
+        struct frequencyMonitorChannel *cp = &channels[channel];
+        cp->window[sweep.windowHead] = cp->latest;
+    }
+    sweep.windowHead = (sweep.windowHead + 1) % WINDOW_SIZE;
+    if (sweep.windowCount < WINDOW_SIZE) sweep.windowCount++;
+}
+
+/*
+ * Most recent reading
+ * Read hardware directly until the first sweep has been made.
+ */
+unsigned int
+frequencyMonitorGet(unsigned int channel)
+{
+    if (channel >= FREQUENCY_MONITOR_CHANNEL_COUNT) return 0;
+    if (sweep.sweepCount == 0) return measure(channel);
+    return channels[channel].latest;
+}
+
+static unsigned int
+isqrt(uint64_t v)
+{
+    uint64_t r = 0, bit = (uint64_t)1 << 62;
+
+    while (bit > v) bit >>= 2;
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+/*
+ * Statistics over the readings in the window
+ * Return number of readings.
+ */
+int
+frequencyMonitorGetStats(unsigned int channel,
+                         struct frequencyMonitorStats *statsp)
+{
+    struct frequencyMonitorChannel *cp;
+    int i, n = sweep.windowCount;
+    unsigned int min = ~0, max = 0;
+    int64_t sum = 0, sumSq = 0;
+
+    if ((channel >= FREQUENCY_MONITOR_CHANNEL_COUNT) || (n == 0)) return 0;
+    cp = &channels[channel];
+
+    /*
+     * Accumulate offsets from first reading to keep sums small
+     */
+    for (i = 0 ; i < n ; i++) {
+        unsigned int v = cp->window[i];
+        int64_t d = (int64_t)v - cp->window[0];
+        if (v < min) min = v;
+        if (v > max) max = v;
+        sum += d;
+        sumSq += d * d;
+    }
+    statsp->latest = cp->latest;
+    statsp->min = min;
+    statsp->max = max;
+    statsp->mean = cp->window[0] + (sum / n);
+    statsp->stddev = isqrt(((n * sumSq) - (sum * sum)) / ((int64_t)n * n));
+    return n;
+}
+
+/*
+ * Latest reading from every channel
+ */
+int
+frequencyMonitorFetch(uint32_t *args)
+{
+    unsigned int channel;
+
+    for (channel = 0 ; channel < FREQUENCY_MONITOR_CHANNEL_COUNT ; channel++) {
+        *args++ = frequencyMonitorGet(channel);
+    }
+    return FREQUENCY_MONITOR_CHANNEL_COUNT;
+}
@@ -5,7 +5,23 @@
 #ifndef _FREQUENCY_MONITOR_H_
 #define _FREQUENCY_MONITOR_H_
 
+#include <stdint.h>
+
+#define FREQUENCY_MONITOR_CHANNEL_COUNT 8
+
+struct frequencyMonitorStats {
+    unsigned int latest;
+    unsigned int min;
+    unsigned int max;
+    unsigned int mean;
+    unsigned int stddev;
+};
+
 int frequencyMonitorUsingPPS(void);
+void frequencyMonitorCrank(void);
 unsigned int frequencyMonitorGet(unsigned int channel);
+int frequencyMonitorGetStats(unsigned int channel,
+                             struct frequencyMonitorStats *statsp);
+int frequencyMonitorFetch(uint32_t *args);
 
 #endif /* _FREQUENCY_MONITOR_H_ */
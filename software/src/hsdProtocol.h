@@ -49,6 +49,12 @@ struct hsdPacket {
 # define HSD_PROTOCOL_CMD_LONGIN_IDX_AFE_SERIAL_NUMBER   0x05
 # define HSD_PROTOCOL_CMD_LONGIN_IDX_RFADC_SAMPLING_CLK  0x06
 # define HSD_PROTOCOL_CMD_LONGIN_IDX_GIT_HASH_ID         0x07
+# define HSD_PROTOCOL_CMD_LONGIN_IDX_TIMING_STATUS       0x08
+#  define HSD_PROTOCOL_TIMING_EVR_ALIGNED            0x01
+#  define HSD_PROTOCOL_TIMING_EVR_ALIGNMENT_LATE     0x02
+#  define HSD_PROTOCOL_TIMING_MARKERS_CHECKED        0x04
+#  define HSD_PROTOCOL_TIMING_HEARTBEAT_OK           0x08
+#  define HSD_PROTOCOL_TIMING_PPS_OK                 0x10
 
 #define HSD_PROTOCOL_CMD_HI_LONGOUT          0x1000
 # define HSD_PROTOCOL_CMD_LONGOUT_LO_NO_VALUE        0x0000
@@ -85,5 +91,10 @@ struct hsdPacket {
 #define HSD_PROTOCOL_CMD_HI_PLL_CONFIG       0x4000
 # define HSD_PROTOCOL_CMD_PLL_CONFIG_LO_SET     0x0000
 # define HSD_PROTOCOL_CMD_PLL_CONFIG_LO_GET     0x0100
+# define HSD_PROTOCOL_CMD_PLL_CONFIG_LO_SAMPLING_CLK 0x0200
+
+#define HSD_PROTOCOL_CMD_HI_EYESCAN          0x5000
+
+#define HSD_PROTOCOL_CMD_HI_EVENT_LOG        0x6000
 
 #endif /* _HIGH_SPEED_DIGITIZER_PROTOCOL_ */
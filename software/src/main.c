@@ -14,6 +14,7 @@
 #include "evr.h"
 #include "eyescan.h"
 #include "ffs.h"
+#include "frequencyMonitor.h"
 #include "gpio.h"
 #include "iic.h"
 #include "mgt.h"
@@ -228,8 +229,13 @@ main(void)
     for (;;) {
         checkForReset();
         acquisitionCrank();
+        evrCrank();
         mgtCrankRxAligner();
+        rfADCcrank();
+        rfClkCrank();
+        frequencyMonitorCrank();
         xemacif_input(&netif);
+        tftpCrank();
         consoleCheck();
         ffsCheck();
         displayUpdate();
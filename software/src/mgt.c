@@ -29,12 +29,14 @@
  */
 
 #include <stdio.h>
+#include "drp.h"
 #include "gpio.h"
 #include "mgt.h"
 #include "util.h"
 #include "rfadc.h"
 
 #define CSR_W_RX_BIT_SLIDE          0x80
+#define CSR_W_RX_DATAPATH_RESET     0x10
 #define CSR_W_BB_TX_STRT_REQUEST    0x08
 #define CSR_W_BB_TX_RST_REQUEST     0x04
 #define CSR_RW_TX_RESET             0x02
@@ -44,6 +46,7 @@
 #define CSR_R_BAD_K_SHIFT           22
 #define CSR_R_BAD_CHAR_MASK         0x003FF000U
 #define CSR_R_BAD_CHAR_SHIFT        12
+#define CSR_R_RX_DATAPATH_RESET     0x100
 #define CSR_R_RX_ALIGNED            0x080
 #define CSR_R_TX_RESET_DONE         0x040
 #define CSR_R_RX_RESET_DONE         0x020
@@ -54,6 +57,48 @@
                            CSR_R_RX_RESET_DONE | \
                            CSR_R_CPLL_LOCKED)
 
+/*
+ * Report lack of alignment if not achieved this long after startup
+ */
+#define ALIGNMENT_TIMEOUT_US        20000000
+
+/*
+ * A correctly framed receiver sees enough commas to declare alignment
+ * well within this time of coming out of reset.
+ */
+#define RX_SETTLE_US                100
+
+/*
+ * Fall back to resetting the entire transceiver now and then in
+ * case something other than framing is preventing alignment.
+ */
+#define FULL_RESET_INTERVAL         500
+
+/*
+ * DRP port of the EVR transceiver, relative to GPIO_IDX_EVR_GTY_DRP
+ */
+#define EVR_DRP_PORT                0
+
+static enum alignerState { S_APPLY_RESET, S_HOLD_RESET,
+                           S_AWAIT_RESET_COMPLETION, S_POST_RESET_DELAY,
+                           S_CONFIRM_ALIGNMENT, S_ALIGNMENT_ACHIEVED,
+                           S_ALIGNED } state = S_ALIGNED;
+static int isStartup, isLate, needFullReset;
+static uint32_t whenStarted;
+
+static struct alignerStats {
+    uint32_t    alignments;
+    uint32_t    attempts;       /* Resets in alignment under way */
+    uint32_t    whenStarted;
+    uint32_t    lastAttempts;
+    uint32_t    lastMicroseconds;
+    uint32_t    maxAttempts;
+    uint32_t    maxMicroseconds;
+    uint32_t    totalAttempts;
+    uint32_t    fullResets;
+    uint32_t    incompleteResets;
+} stats;
+
 /*
  * Return monitor values
  */
@@ -67,6 +112,28 @@ mgtFetch(uint32_t *args)
     return aIndex;
 }
 
+static void
+beginAlignment(void)
+{
+    stats.attempts = 0;
+    stats.whenStarted = MICROSECONDS_SINCE_BOOT();
+    state = S_APPLY_RESET;
+}
+
+static void
+alignmentAchieved(void)
+{
+    uint32_t us = MICROSECONDS_SINCE_BOOT() - stats.whenStarted;
+
+    stats.alignments++;
+    stats.lastAttempts = stats.attempts;
+    stats.lastMicroseconds = us;
+    if (stats.attempts > stats.maxAttempts) stats.maxAttempts = stats.attempts;
+    if (us > stats.maxMicroseconds) stats.maxMicroseconds = us;
+    printf("EVR aligned after %u resets in %u us.\n",
+                                (unsigned int)stats.attempts, (unsigned int)us);
+}
+
 /*
  * Receiver can place its recovered clock at 20 different phases relative to
  * the incoming data.  This is not acceptable since it affects the alignment
@@ -74,30 +141,39 @@ mgtFetch(uint32_t *args)
  * with automatic bit-slide disabled and manual bit-slide never performed.
  * Instead the following state machine keeps resetting the receiver until the
  * receiver comes out of reset in the spot that is aligned.
+ * Only the receiver datapath is reset, apart from the first attempt after
+ * startup or a reset that fails to complete, so each attempt is short.
+ * An attempt is abandoned as soon as it is clear that the receiver has not
+ * come up aligned rather than after a fixed delay.
  */
 int
 mgtCrankRxAligner(void)
 {
     uint32_t csr = GPIO_READ(GPIO_IDX_GTY_CSR);
     static uint32_t whenEntered;
-    static int resetCount;
-    static enum state { S_APPLY_RESET, S_HOLD_RESET, S_AWAIT_RESET_COMPLETION,
-                        S_POST_RESET_DELAY, S_CONFIRM_ALIGNMENT,
-                        S_ALIGNMENT_ACHIEVED, S_ALIGNED } state = S_ALIGNED;
-    enum state oldState = state;
+    enum alignerState oldState = state;
 
     switch (state) {
     case S_APPLY_RESET:
-        GPIO_WRITE(GPIO_IDX_GTY_CSR, CSR_RW_GT_RESET_ALL);
+        if (needFullReset
+         || !(csr & CSR_R_CPLL_LOCKED)
+         || ((stats.attempts % FULL_RESET_INTERVAL) ==
+                                                (FULL_RESET_INTERVAL - 1))) {
+            GPIO_WRITE(GPIO_IDX_GTY_CSR, CSR_RW_GT_RESET_ALL);
+            drpInvalidate(EVR_DRP_PORT);
+            stats.fullResets++;
+            needFullReset = 0;
+        }
+        else {
+            GPIO_WRITE(GPIO_IDX_GTY_CSR, CSR_W_RX_DATAPATH_RESET);
+        }
         state = S_HOLD_RESET;
         break;
 
     case S_HOLD_RESET:
         if ((MICROSECONDS_SINCE_BOOT() - whenEntered) > 10) {
-            resetCount++;
-            if ((debugFlags & DEBUGFLAG_EVR) && (resetCount % 1000000) == 0) {
-                printf("EVR reset count %d\n", resetCount);
-            }
+            stats.attempts++;
+            stats.totalAttempts++;
             GPIO_WRITE(GPIO_IDX_GTY_CSR, 0);
             state = S_AWAIT_RESET_COMPLETION;
         }
@@ -114,17 +190,22 @@ mgtCrankRxAligner(void)
         }
         else if ((MICROSECONDS_SINCE_BOOT() - whenEntered) > 250000) {
             warn("EVR reset incomplete: %X", csr);
+            stats.incompleteResets++;
+            needFullReset = 1;
             state = S_APPLY_RESET;
         }
         break;
 
     case S_POST_RESET_DELAY:
-        if ((MICROSECONDS_SINCE_BOOT() - whenEntered) > 200) {
+        if (csr & CSR_R_RX_ALIGNED) {
             state = S_CONFIRM_ALIGNMENT;
         }
+        else if ((MICROSECONDS_SINCE_BOOT() - whenEntered) > RX_SETTLE_US) {
+            state = S_APPLY_RESET;
+        }
+        break;
 
     case S_CONFIRM_ALIGNMENT:
-    // FIXME: CHECK RESET DONE TOO?
         if (!(csr & CSR_R_RX_ALIGNED)) {
             state = S_APPLY_RESET;
         }
@@ -134,12 +215,17 @@ mgtCrankRxAligner(void)
         break;
 
     case S_ALIGNMENT_ACHIEVED:
-        printf("EVR aligned after %d resets.\n", resetCount);
-        resetCount = 0;
+        alignmentAchieved();
+        if (isStartup) {
+            printf("mgtInit done: %d us\n",
+                                    MICROSECONDS_SINCE_BOOT() - whenStarted);
+            isStartup = 0;
+            isLate = 0;
+        }
         GPIO_WRITE(GPIO_IDX_GTY_CSR, CSR_RW_TX_RESET);
         microsecondSpin(2);
         GPIO_WRITE(GPIO_IDX_GTY_CSR, 0);
-        rfADCsync();
+        rfADCresync();
         state = S_ALIGNED;
         break;
 
@@ -150,50 +236,70 @@ mgtCrankRxAligner(void)
                            (csr & CSR_R_BAD_K_MASK) >> CSR_R_BAD_K_SHIFT,
                            (csr & CSR_R_BAD_CHAR_MASK) >> CSR_R_BAD_CHAR_SHIFT);
             lostAlignmentCount++;
-            state = S_APPLY_RESET;
+            beginAlignment();
         }
         break;
     }
     if (state != oldState) {
         whenEntered = MICROSECONDS_SINCE_BOOT();
     }
+    if (isStartup && !isLate
+     && ((MICROSECONDS_SINCE_BOOT() - whenStarted) > ALIGNMENT_TIMEOUT_US)) {
+        warn("No EVR alignment -- CSR:%X", GPIO_READ(GPIO_IDX_GTY_CSR));
+        isLate = 1;
+    }
     return (state == S_ALIGNED);
 }
 
+/*
+ * Alignment is achieved by mgtCrankRxAligner from the main loop
+ * so startup need not wait for the event link.
+ */
 void
 mgtInit(void)
 {
-    uint32_t csr, then, start;
-    int pass = 0;
-    GPIO_WRITE(GPIO_IDX_GTY_CSR, CSR_RW_GT_RESET_ALL);
-    microsecondSpin(100);
-    GPIO_WRITE(GPIO_IDX_GTY_CSR, 0);
-    then = MICROSECONDS_SINCE_BOOT();
-    while (((csr = GPIO_READ(GPIO_IDX_GTY_CSR)) & CSR_R_RESETS_DONE) !=
-                                                            CSR_R_RESETS_DONE) {
-        if ((MICROSECONDS_SINCE_BOOT() - then) > 250000) {
-            warn("EVR didn't reset: %X", csr);
-            return;
-        }
+    whenStarted = MICROSECONDS_SINCE_BOOT();
+    isStartup = 1;
+    isLate = 0;
+    needFullReset = 1;
+    beginAlignment();
+}
+
+int
+mgtStatus(void)
+{
+    int status = 0;
+
+    if (state == S_ALIGNED) status |= MGT_STATUS_ALIGNED;
+    if (isLate)             status |= MGT_STATUS_ALIGNMENT_LATE;
+    return status;
+}
+
+void
+mgtShowStatistics(void)
+{
+    printf("EVR alignments: %u, lost: %u\n", (unsigned int)stats.alignments,
+                                             (unsigned int)lostAlignmentCount);
+    printf("   Resets: %u (%u full, %u incomplete)\n",
+                                         (unsigned int)stats.totalAttempts,
+                                         (unsigned int)stats.fullResets,
+                                         (unsigned int)stats.incompleteResets);
+    if (stats.alignments) {
+        printf("   Last alignment: %u resets in %u us\n",
+                                         (unsigned int)stats.lastAttempts,
+                                         (unsigned int)stats.lastMicroseconds);
+        printf("  Worst alignment: %u resets, %u us\n",
+                                         (unsigned int)stats.maxAttempts,
+                                         (unsigned int)stats.maxMicroseconds);
     }
-    printf("MGT CSR after reset: %X\n", GPIO_READ(GPIO_IDX_GTY_CSR));
-    start = then = MICROSECONDS_SINCE_BOOT();
-    while (!mgtCrankRxAligner()) {
-        uint32_t now = MICROSECONDS_SINCE_BOOT();
-        if ((now - then) > 2000000) {
-            if (++pass >= 10) {
-                warn("No EVR alignment -- CSR:%X", GPIO_READ(GPIO_IDX_GTY_CSR));
-                return;
-            }
-            then = now;
-            microsecondSpin(200000);
-        }
-        microsecondSpin(5);
+    if (state != S_ALIGNED) {
+        printf("   Aligning: %u resets in %u us\n",
+                      (unsigned int)stats.attempts,
+                      (unsigned int)(MICROSECONDS_SINCE_BOOT() -
+                                                          stats.whenStarted));
     }
-    printf("mgtInit done: %d us\n", MICROSECONDS_SINCE_BOOT()- start);
 }
 
-
 void
 mgtRxBitslide(void)
 {
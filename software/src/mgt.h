@@ -35,9 +35,14 @@
 #ifndef _MGT_H_
 #define _MGT_H_
 
+#define MGT_STATUS_ALIGNED          0x1
+#define MGT_STATUS_ALIGNMENT_LATE   0x2
+
 void mgtInit(void);
+int mgtStatus(void);
 int mgtFetch(uint32_t *args);
 void mgtRxBitslide(void);
 int mgtCrankRxAligner(void);
+void mgtShowStatistics(void);
 
 #endif /* _MGT_H_ */
@@ -13,6 +13,14 @@
 #include "mmcm.h"
 #include "util.h"
 
+/*
+ * MMCME4 limits, scaled by a factor of 1000
+ */
+#define MMCM_MULTIPLIER_MIN   2000
+#define MMCM_MULTIPLIER_MAX 128000
+#define MMCM_DIVIDER_MIN      1000
+#define MMCM_DIVIDER_MAX    128000
+
 #define RD(b,o) Xil_In32((b)+(o))
 #define WR(b,o,v) Xil_Out32((b)+(o), (v))
 
@@ -108,13 +116,23 @@ mmcmSetAdcClk1Divider(int divider)
     WR(XPAR_RFADC_MMCM_BASEADDR, 0x214, divInt);
 }
 
-void
+/*
+ * Load new settings and wait for lock
+ * The lock indication is stale until the MMCM starts reconfiguring,
+ * so don't take it as valid until it has dropped or a few microseconds
+ * have passed.
+ * Return 0 on success, -1 on failure.
+ */
+#define MMCM_UNLOCK_WINDOW_US   100
+
+int
 mmcmStartReconfig(void)
 {
-    uint32_t then;
+    uint32_t then, us;
+    int sawUnlock = 0;
 
     then = MICROSECONDS_SINCE_BOOT();
-    while (!RD(XPAR_RFADC_MMCM_BASEADDR, 0x04) & 0x1) {
+    while (!(RD(XPAR_RFADC_MMCM_BASEADDR, 0x04) & 0x1)) {
         if ((MICROSECONDS_SINCE_BOOT() - then) > 1000000) {
             warn("Critical -- ADC clock MMCM unlocked");
             break;
@@ -122,22 +140,63 @@ mmcmStartReconfig(void)
     }
     then = MICROSECONDS_SINCE_BOOT();
     WR(XPAR_RFADC_MMCM_BASEADDR, 0x25C, 3);
-    while (!RD(XPAR_RFADC_MMCM_BASEADDR, 0x04) & 0x1) {
-        if ((MICROSECONDS_SINCE_BOOT() - then) > 10000000) {
+    for (;;) {
+        int locked = RD(XPAR_RFADC_MMCM_BASEADDR, 0x04) & 0x1;
+        us = MICROSECONDS_SINCE_BOOT() - then;
+        if (!locked) {
+            sawUnlock = 1;
+        }
+        else if (sawUnlock || (us > MMCM_UNLOCK_WINDOW_US)) {
+            break;
+        }
+        if (us > 10000000) {
             warn("Critical -- ADC clock MMCM won't lock");
+            return -1;
         }
-        return;
     }
-    printf("ADC MMCM locked after %d uS.\n", MICROSECONDS_SINCE_BOOT() - then);
+    printf("ADC MMCM locked after %d uS.\n", (int)us);
+    return 0;
 }
 
-void
-mmcmInit(void)
+/*
+ * Multiplier and dividers are scaled by a factor of 1000.
+ * Return 1 if all are within the MMCM limits.
+ */
+int
+mmcmAdcClkValid(int multiplier, int clk0Divider, int clk1Divider)
 {
+    return (multiplier >= MMCM_MULTIPLIER_MIN)
+        && (multiplier <= MMCM_MULTIPLIER_MAX)
+        && (clk0Divider >= MMCM_DIVIDER_MIN)
+        && (clk0Divider <= MMCM_DIVIDER_MAX)
+        && (clk1Divider >= MMCM_DIVIDER_MIN)
+        && (clk1Divider <= MMCM_DIVIDER_MAX);
+}
+
+/*
+ * Multiplier and dividers are scaled by a factor of 1000.
+ * Return 0 on success, -1 on failure.
+ */
+int
+mmcmConfigureAdcClk(int multiplier, int clk0Divider, int clk1Divider)
+{
+    int status;
+
+    if (!mmcmAdcClkValid(multiplier, clk0Divider, clk1Divider)) {
+        return -1;
+    }
     showAdcClk("Old ");
-    mmcmSetAdcClkMultiplier(ADC_CLK_MMCM_MULTIPLIER);
-    mmcmSetAdcClk0Divider(ADC_CLK_MMCM_DIVIDER);
-    mmcmSetAdcClk1Divider(ADC_CLK_MMCM_CLK1_DIVIDER);
-    mmcmStartReconfig();
+    mmcmSetAdcClkMultiplier(multiplier);
+    mmcmSetAdcClk0Divider(clk0Divider);
+    mmcmSetAdcClk1Divider(clk1Divider);
+    status = mmcmStartReconfig();
     showAdcClk("");
+    return status;
+}
+
+void
+mmcmInit(void)
+{
+    mmcmConfigureAdcClk(ADC_CLK_MMCM_MULTIPLIER, ADC_CLK_MMCM_DIVIDER,
+                                                 ADC_CLK_MMCM_CLK1_DIVIDER);
 }
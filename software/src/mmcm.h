@@ -8,6 +8,10 @@
 void mmcmInit(void);
 void mmcmShow(void);
 void mmcmSetAdcClkMultiplier(int multiplier);
-void mmcmSetAdcClkDivider(int divider);
+void mmcmSetAdcClk0Divider(int divider);
+void mmcmSetAdcClk1Divider(int divider);
+int mmcmStartReconfig(void);
+int mmcmAdcClkValid(int multiplier, int clk0Divider, int clk1Divider);
+int mmcmConfigureAdcClk(int multiplier, int clk0Divider, int clk1Divider);
 
 #endif /* _MMCM_H_ */
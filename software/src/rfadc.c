@@ -11,8 +11,12 @@ typedef int32_t __s32;
 typedef int64_t __s64;
 #include <xrfdc.h>
 #include <xrfdc_mts.h>
+#include "evr.h"
+#include "frequencyMonitor.h"
 #include "gpio.h"
 #include "rfadc.h"
+#include "sysref.h"
+#include "systemParameters.h"
 #include "util.h"
 
 #define XRFDC_ADC_OVR_VOLTAGE_MASK  0x04000000U
@@ -24,10 +28,48 @@ typedef int64_t __s64;
 #define REG_W_MASTER_RESET   0x0004
 #define REG_R_POWER_ON_STATE 0x0004
 
+#define STATUS_POLL_INTERVAL_US 5000
+
+#define FREQUENCY_MONITOR_CHANNEL_RFDC_ADC0 4
+
 static XRFdc rfDC;
 static int initDone;
+
+/*
+ * Start with build-time values but may be changed
+ * when the sampling clock is reconfigured.
+ */
+static double refClkMHz = CFG_ADC_REF_CLK_FREQ;
+static double samplingClkMHz = CFG_ADC_SAMPLING_CLK_FREQ;
 static char logMessageBuffer[200];
 
+/*
+ * Status accumulated by background poll
+ */
+static struct rfADCstatusCache {
+    uint32_t     whenPolled;
+    unsigned int status;        /* Status bits since last rfADCstatus() */
+    uint32_t     overrangeCount[CFG_ADC_PHYSICAL_COUNT];
+    uint32_t     overvoltageCount[CFG_ADC_PHYSICAL_COUNT];
+    evrTimestamp whenLastEvent[CFG_ADC_PHYSICAL_COUNT];
+} adcStatus;
+
+/*
+ * Multi-tile synchronization history
+ */
+static struct rfADCsyncStats {
+    int          haveLatency;
+    int          latency[NTILES];
+    int          targetLatency;     /* 0 if groups not aligned */
+    int          targetTooLow;
+    uint32_t     fullCount;
+    uint32_t     skipCount;
+    uint32_t     failCount;
+    uint32_t     latencyChangeCount;
+    uint32_t     lastMicroseconds;
+    uint32_t     maxMicroseconds;
+} syncStats;
+
 /*
  * Stash message in buffer in case it's part of
  * an error message, then print that buffer.
@@ -75,10 +117,19 @@ rfADCshow(void)
             if (adcIdx >= CFG_ADC_PHYSICAL_COUNT) break;
             XRFdc_GetLinkCoupling(&rfDC, tile, adc, &v);
             printf("        ADC %d: %cC link", adcIdx,  v ? 'A' : 'D');
-            XRFdc_GetIntrStatus(&rfDC, XRFDC_ADC_TILE, tile, adc, &v);
-            if (v) {
-                if (v & XRFDC_ADC_OVR_RANGE_MASK) printf(", Overrange");
-                if (v & XRFDC_ADC_OVR_VOLTAGE_MASK) printf(", Overvoltage");
+            if (adcStatus.overrangeCount[adcIdx]) {
+                printf(", %u overrange",
+                        (unsigned int)adcStatus.overrangeCount[adcIdx]);
+            }
+            if (adcStatus.overvoltageCount[adcIdx]) {
+                printf(", %u overvoltage",
+                        (unsigned int)adcStatus.overvoltageCount[adcIdx]);
+            }
+            if (adcStatus.overrangeCount[adcIdx]
+             || adcStatus.overvoltageCount[adcIdx]) {
+                printf(" (latest %u:%09u)",
+                    (unsigned int)adcStatus.whenLastEvent[adcIdx].secPastEpoch,
+                    (unsigned int)adcStatus.whenLastEvent[adcIdx].fraction);
             }
             i = XRFdc_GetCalFreeze(&rfDC, tile, adc, &cfs);
             if (i == XST_SUCCESS) {
@@ -106,6 +157,7 @@ rfADCshow(void)
             }
         }
     }
+    rfADCshowSync();
 }
 
 int
@@ -147,8 +199,8 @@ static void rfADCCfgDefaults(void)
     for (tile = 0 ; tile < NTILES ; tile++) {
         i = XRFdc_DynamicPLLConfig(&rfDC, XRFDC_ADC_TILE, tile,
                                           XRFDC_EXTERNAL_CLK,
-                                          CFG_ADC_REF_CLK_FREQ,
-                                          CFG_ADC_SAMPLING_CLK_FREQ);
+                                          refClkMHz,
+                                          samplingClkMHz);
         if (i != XST_SUCCESS) fatal("XRFdc_DynamicPLLConfig=%d", i);
 
         // Override GUI mixer settings
@@ -210,19 +262,72 @@ rfADCrestart(void)
     if (i != XST_SUCCESS) warn("Critical -- %s\nXRFdc_Reset=%d",
                                                            logMessageBuffer, i);
     rfADCCfgDefaults();
+    syncStats.haveLatency = 0;
 }
 
+/*
+ * Tiles are clocked externally so the reference clock is the sampling clock.
+ * Takes effect at next restart.
+ */
 void
-rfADCsync(void)
+rfADCsetSamplingClock(double mhz)
+{
+    refClkMHz = mhz;
+    samplingClkMHz = mhz;
+}
+
+/*
+ * RF ADC sampling rate limits with an external clock
+ * A rate outside these would make the restart fail.
+ */
+#if defined(__TARGET_HSD_ZCU208__) || defined(__TARGET_BPM_ZCU208__)
+# define SAMPLING_CLK_KHZ_MAX   5000000
+#else
+# define SAMPLING_CLK_KHZ_MAX   4096000
+#endif
+#define SAMPLING_CLK_KHZ_MIN    500000
+
+int
+rfADCsamplingClockValid(unsigned int kHz)
+{
+    return (kHz >= SAMPLING_CLK_KHZ_MIN) && (kHz <= SAMPLING_CLK_KHZ_MAX);
+}
+
+/*
+ * Sampling clock frequency (kHz)
+ * Measured from the tile 0 fabric clock output if possible.
+ */
+unsigned int
+rfADCsamplingClockKHz(void)
+{
+    unsigned int hz, div;
+    uint16_t code;
+
+    if (initDone
+     && (XRFdc_GetFabClkOutDiv(&rfDC, XRFDC_ADC_TILE, 0, &code) == XST_SUCCESS)
+     && (code >= XRFDC_FAB_CLK_DIV1) && (code <= XRFDC_FAB_CLK_DIV16)
+     && ((hz = frequencyMonitorGet(FREQUENCY_MONITOR_CHANNEL_RFDC_ADC0)) != 0)) {
+        div = 1 << (code - XRFDC_FAB_CLK_DIV1);
+        return ((hz / 100) * div + 5) / 10;
+    }
+    return samplingClkMHz * 1000 + 0.5;
+}
+
+/*
+ * Return 0 on success, -1 on failure
+ */
+static int
+syncTiles(void)
 {
     int tile, latency, status;
+    int changed = 0;
+    int target = systemParameters.adcTargetLatency;
     XRFdc_IPStatus IPStatus;
     XRFdc_MultiConverter_Sync_Config adcConfig, dacConfig;
 
-    if (!initDone) return;
     if (XRFdc_GetIPStatus(&rfDC, &IPStatus) != 0) {
         printf("Can't get IP status.\n");
-        return;
+        return -1;
     }
     XRFdc_MultiConverter_Init(&dacConfig, NULL, NULL);
     XRFdc_MultiConverter_Init(&adcConfig, NULL, NULL);
@@ -238,7 +343,7 @@ rfADCsync(void)
     status = XRFdc_MTS_Sysref_Config(&rfDC, &dacConfig, &adcConfig, 1);
     if (status != XRFDC_MTS_OK) {
         warn("XRFdc_MTS_Sysref_Config(1) failed: %d", status);
-        return;
+        return -1;
     }
 
     /*
@@ -247,33 +352,70 @@ rfADCsync(void)
     status = XRFdc_MultiConverter_Sync(&rfDC, XRFDC_ADC_TILE, &adcConfig);
     if (status != XRFDC_MTS_OK) {
         warn("XRFdc_MultiConverter_Sync (tiles) failed: %d", status);
-        return;
+        XRFdc_MTS_Sysref_Config(&rfDC, &dacConfig, &adcConfig, 0);
+        return -1;
     }
 
-#if 0
-/* If latency variation causes problems, say with acquired signals moving
- * relative to event triggers, this code can be enabled, perhaps with the
- * addition of a system configuration value for the target latency.
- * E. Norum 2020-10-10 */
+
     /*
      * Synchronize between groups as described on page 125 of PG269 (v2.1)
      * "Zynq UltraScale+ RFSoC RF Data Converter", "Advanced Multi-Converter
-     * Sync API Use".
+     * Sync API Use".  This places acquired signals at the same position
+     * relative to event triggers from one startup to the next.
+     * The target must be no less than the largest measured latency.
      */
-    latency = -1;
+    syncStats.targetLatency = 0;
+    syncStats.targetTooLow = 0;
+    if (target > 0) {
+        latency = -1;
+        for (tile = 0 ; tile < NTILES ; tile++) {
+            if ((adcConfig.Tiles & (1 << tile))
+             && ((int)adcConfig.Latency[tile] > latency)) {
+                latency = adcConfig.Latency[tile];
+            }
+        }
+        if (target < latency) {
+            warn("ADC target latency %d less than measured latency %d",
+                                                             target, latency);
+            syncStats.targetTooLow = 1;
+        }
+        else {
+            adcConfig.Target_Latency = target;
+            status = XRFdc_MultiConverter_Sync(&rfDC, XRFDC_ADC_TILE,
+                                                                &adcConfig);
+            if (status != XRFDC_MTS_OK) {
+                warn("XRFdc_MultiConverter_Sync (groups) failed: %d", status);
+                XRFdc_MTS_Sysref_Config(&rfDC, &dacConfig, &adcConfig, 0);
+                return -1;
+            }
+            syncStats.targetLatency = target;
+        }
+    }
     for (tile = 0 ; tile < NTILES ; tile++) {
-        if (adcConfig.Latency[tile] > latency) {
-            latency = adcConfig.Latency[tile];
+        if (!(adcConfig.Tiles & (1 << tile))) continue;
+        if (syncStats.haveLatency
+         && (syncStats.latency[tile] != adcConfig.Latency[tile])) {
+            changed++;
         }
+        syncStats.latency[tile] = adcConfig.Latency[tile];
     }
-    adcConfig.Target_Latency = latency + 8;
-    status = XRFdc_MultiConverter_Sync(&rfDC, XRFDC_ADC_TILE, &adcConfig);
-    if (status != XRFDC_MTS_OK) {
-        warn("XRFdc_MultiConverter_Sync (groups) failed: %d", status);
-        return;
+    if (changed) {
+        syncStats.latencyChangeCount++;
     }
-#endif
-    printf("ADC synchronization complete.\n");
+    syncStats.haveLatency = 1;
+    printf("ADC synchronization complete, latencies:");
+    for (tile = 0 ; tile < NTILES ; tile++) {
+        if (adcConfig.Tiles & (1 << tile)) {
+            printf(" %d", syncStats.latency[tile]);
+        }
+    }
+    if (syncStats.targetLatency) {
+        printf(" (target %d)", syncStats.targetLatency);
+    }
+    if (changed) {
+        printf(", %d changed", changed);
+    }
+    printf(".\n");
 
     /*
      * Disable SYSREF
@@ -281,8 +423,107 @@ rfADCsync(void)
     status = XRFdc_MTS_Sysref_Config(&rfDC, &dacConfig, &adcConfig, 0);
     if (status != XRFDC_MTS_OK) {
         warn("XRFdc_MTS_Sysref_Config(0) failed: %d", status);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Full multi-tile synchronization
+ */
+void
+rfADCsync(void)
+{
+    uint32_t whenStarted = MICROSECONDS_SINCE_BOOT();
+
+    if (!initDone) return;
+    if (syncTiles() == 0) {
+        syncStats.fullCount++;
+        sysrefIsStable();
+    }
+    else {
+        syncStats.failCount++;
+        syncStats.haveLatency = 0;
+    }
+    syncStats.lastMicroseconds = MICROSECONDS_SINCE_BOOT() - whenStarted;
+    if (syncStats.lastMicroseconds > syncStats.maxMicroseconds) {
+        syncStats.maxMicroseconds = syncStats.lastMicroseconds;
+    }
+}
+
+/*
+ * Resynchronize after event receiver realignment.
+ * If SYSREF has been seen at the expected interval in both the reference
+ * and ADC AXI clock domains ever since the last successful synchronization
+ * then the tile latencies can not have changed and synchronization can
+ * be skipped.
+ */
+void
+rfADCresync(void)
+{
+    uint32_t whenStarted = MICROSECONDS_SINCE_BOOT();
+
+    if (!initDone) return;
+    if (syncStats.haveLatency && sysrefIsStable()) {
+        syncStats.skipCount++;
+        syncStats.lastMicroseconds = MICROSECONDS_SINCE_BOOT() - whenStarted;
+        printf("ADC synchronization unchanged.\n");
         return;
     }
+    rfADCsync();
+}
+
+void
+rfADCshowSync(void)
+{
+    int tile;
+
+    printf("ADC synchronization: %u full, %u skipped, %u failed, "
+                                                 "%u latency changes\n",
+                                    (unsigned int)syncStats.fullCount,
+                                    (unsigned int)syncStats.skipCount,
+                                    (unsigned int)syncStats.failCount,
+                                    (unsigned int)syncStats.latencyChangeCount);
+    printf("   Last %u us, longest %u us\n",
+                                    (unsigned int)syncStats.lastMicroseconds,
+                                    (unsigned int)syncStats.maxMicroseconds);
+    if (syncStats.haveLatency) {
+        printf("   Tile latencies:");
+        for (tile = 0 ; tile < NTILES ; tile++) {
+            printf(" %d", syncStats.latency[tile]);
+        }
+        printf("\n");
+    }
+    if (syncStats.targetLatency) {
+        printf("   Target latency: %d\n", syncStats.targetLatency);
+    }
+    else if (syncStats.targetTooLow) {
+        printf("   Target latency %d too low, groups not aligned\n",
+                                        systemParameters.adcTargetLatency);
+    }
+}
+
+/*
+ * Return the group alignment target latency, with the
+ * RFADC_LATENCY_* flags in the upper half, then the latency
+ * of each tile, or ~0 if not known.
+ */
+int
+rfADCfetchLatencies(uint32_t *args)
+{
+    int aIndex = 0;
+    int tile;
+    uint32_t flags = 0;
+
+    if (syncStats.haveLatency) flags |= RFADC_LATENCY_VALID;
+    if (syncStats.targetLatency) flags |= RFADC_LATENCY_GROUPS_ALIGNED;
+    if (syncStats.targetTooLow) flags |= RFADC_LATENCY_TARGET_TOO_LOW;
+    args[aIndex++] = (flags << 16) |
+                            (systemParameters.adcTargetLatency & 0xFFFF);
+    for (tile = 0 ; tile < NTILES ; tile++) {
+        args[aIndex++] = syncStats.haveLatency ? syncStats.latency[tile] : ~0;
+    }
+    return aIndex;
 }
 
 void
@@ -320,27 +561,94 @@ rfADCfreezeCalibration(int channel, int freeze)
     }
 }
 
-unsigned int
-rfADCstatus(void)
+/*
+ * Poll the overrange/overvoltage interrupt status of each ADC.
+ * Each poll finding a condition counts as one event.
+ */
+static void
+pollStatus(void)
 {
-    int status = 0;
     int tile, adc;
     int statusShift = 0;
+    int haveTime = 0;
+    evrTimestamp now;
     uint32_t v;
 
     for (tile = 0 ; tile < NTILES ; tile++) {
         for (adc = 0 ; adc < ADC_PER_TILE ; adc++) {
+            int adcIdx = (tile * ADC_PER_TILE) + adc;
             int b = 0;
-            if (((tile * ADC_PER_TILE) + adc) >= CFG_ADC_PHYSICAL_COUNT) break;
+            if (adcIdx >= CFG_ADC_PHYSICAL_COUNT) break;
             XRFdc_GetIntrStatus(&rfDC, XRFDC_ADC_TILE, tile, adc, &v);
             if (v) {
-                b |= (v & XRFDC_ADC_OVR_RANGE_MASK) ? 0x1 : 0;
-                b |= (v & XRFDC_ADC_OVR_VOLTAGE_MASK)  ? 0x2 : 0;
+                if (v & XRFDC_ADC_OVR_RANGE_MASK) {
+                    adcStatus.overrangeCount[adcIdx]++;
+                    b |= 0x1;
+                }
+                if (v & XRFDC_ADC_OVR_VOLTAGE_MASK) {
+                    adcStatus.overvoltageCount[adcIdx]++;
+                    b |= 0x2;
+                }
                 XRFdc_IntrClr(&rfDC, XRFDC_ADC_TILE, tile, adc, v);
+                if (b) {
+                    if (!haveTime) {
+                        evrCurrentTime(&now);
+                        haveTime = 1;
+                    }
+                    adcStatus.whenLastEvent[adcIdx] = now;
+                }
             }
-            status |= b << statusShift;
+            adcStatus.status |= b << statusShift;
             statusShift += 2;
         }
     }
+}
+
+void
+rfADCcrank(void)
+{
+    if (!initDone) return;
+    if ((MICROSECONDS_SINCE_BOOT() - adcStatus.whenPolled) <
+                                                    STATUS_POLL_INTERVAL_US) {
+        return;
+    }
+    adcStatus.whenPolled = MICROSECONDS_SINCE_BOOT();
+    pollStatus();
+}
+
+/*
+ * Return status bits accumulated since the previous call
+ */
+unsigned int
+rfADCstatus(void)
+{
+    unsigned int status = adcStatus.status;
+
+    adcStatus.status = 0;
     return status;
 }
+
+/*
+ * Return overrange/overvoltage event counts, saturated to 16 bits,
+ * for each ADC followed by the seconds of the most recent event.
+ */
+int
+rfADCfetchEventCounts(uint32_t *args)
+{
+    int aIndex = 0;
+    int i;
+    uint32_t latest = 0;
+
+    for (i = 0 ; i < CFG_ADC_PHYSICAL_COUNT ; i++) {
+        uint32_t r = adcStatus.overrangeCount[i];
+        uint32_t v = adcStatus.overvoltageCount[i];
+        if (r > 0xFFFF) r = 0xFFFF;
+        if (v > 0xFFFF) v = 0xFFFF;
+        args[aIndex++] = (v << 16) | r;
+        if ((r || v) && (adcStatus.whenLastEvent[i].secPastEpoch > latest)) {
+            latest = adcStatus.whenLastEvent[i].secPastEpoch;
+        }
+    }
+    args[aIndex++] = latest;
+    return aIndex;
+}
@@ -4,12 +4,26 @@
 #ifndef _RFADC_H_
 #define _RFADC_H_
 
+#include <stdint.h>
+
+#define RFADC_LATENCY_VALID             0x1
+#define RFADC_LATENCY_GROUPS_ALIGNED    0x2
+#define RFADC_LATENCY_TARGET_TOO_LOW    0x4
+
 void rfADCinit(void);
 void rfADCsync(void);
+void rfADCresync(void);
+void rfADCshowSync(void);
+int rfADCfetchLatencies(uint32_t *args);
 void rfADCrestart(void);
+void rfADCsetSamplingClock(double mhz);
+unsigned int rfADCsamplingClockKHz(void);
+int rfADCsamplingClockValid(unsigned int kHz);
 void rfADCfreezeCalibration(int channel, int freeze);
 void rfADCshow(void);
+void rfADCcrank(void);
 unsigned int rfADCstatus(void);
+int rfADCfetchEventCounts(uint32_t *args);
 int rfADClinkCouplingIsAC(void);
 
 #endif  /* _RFADC_H_ */
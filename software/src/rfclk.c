@@ -4,9 +4,13 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <xil_assert.h>
+#include "afe.h"
+#include "gpio.h"
 #include "iic.h"
+#include "mmcm.h"
 #include "rfadc.h"
 #include "rfclk.h"
+#include "sysref.h"
 #include "util.h"
 
 /*
@@ -37,21 +41,80 @@ rfClkInitLMK04xx(void)
 
 /*
  * Initialze LMX2594 frequency synthesizer
+ * Registers are written and read back as a stream of SPI transfers
+ * rather than one I2C transaction at a time.
  */
+#define SPI_MUX_CHANNEL_COUNT   4
+#define LMX2594_REGISTER_LIMIT  128 /* 7 bit register address */
+#define LMX2594_LOCK_TIMEOUT_US 10000
+#define VTUNE_LOCKED            2
+
 static const char * const vTuneNames[4] =
                              { "Vtune Low", "Invalid", "Locked", "Vtune High" };
-static int lmx2594v0InitValues[LMX2594_MUX_SEL_SIZE];
+static const uint16_t chDiv[32] = {
+     2, 4, 6, 8, 12, 16, 24, 32, 48, 64, 72, 96, 128, 192, 256, 384, 512, 768};
+static int lmx2594v0InitValues[SPI_MUX_CHANNEL_COUNT];
 
-static void
-init2594(int muxSelect, const uint32_t *values, int n)
+static struct lmx2594Stats {
+    uint32_t configCount;
+    uint32_t lastConfigUs;      /* RESET through lock */
+    uint32_t lastLockUs;        /* FCAL_EN through lock */
+    uint32_t maxLockUs;
+    uint32_t lockFailures;
+    uint32_t verifyFailures;
+    uint32_t expectedHash;
+    uint32_t readbackHash;
+    int      isLocked;
+    int      isVerified;
+} lmx2594Stats[SPI_MUX_CHANNEL_COUNT];
+
+static int
+read2594(int muxSelect, int reg)
+{
+    uint32_t v = reg << 16;
+    if (!lmx2594readStream(muxSelect, &v, 1)) return 0;
+    return v & 0xFFFF;
+}
+
+/*
+ * FNV-1a hash of register (address << 16) | value words
+ */
+static uint32_t
+hashWord(uint32_t hash, uint32_t v)
 {
     int i;
+    for (i = 0 ; i < 4 ; i++) {
+        hash = (hash ^ ((v >> (i * 8)) & 0xFF)) * 16777619;
+    }
+    return hash;
+}
+
+/*
+ * R0 is modified below and R110 through R112 are read-only status
+ */
+static int
+registerIsVerifiable(int reg)
+{
+    return (reg != 0) && (reg < 110);
+}
+
+static int
+init2594(int muxSelect, const uint32_t *values, int n)
+{
+    static uint32_t stream[2 + LMX2594_REGISTER_LIMIT];
+    int i, nStream = 0;
+
+    if (n > LMX2594_REGISTER_LIMIT) {
+        warn("LMX2594 (SPI MUX CHAN %d) -- %d values, only first %d written",
+                                      muxSelect, n, LMX2594_REGISTER_LIMIT);
+        n = LMX2594_REGISTER_LIMIT;
+    }
 
     /*
      * Apply and remove RESET
      */
-    lmx2594write(muxSelect, 0x002412);
-    lmx2594write(muxSelect, 0x002410);
+    stream[nStream++] = 0x002412;
+    stream[nStream++] = 0x002410;
 
     /*
      * Write registers with values from TICS Pro.
@@ -66,7 +129,54 @@ init2594(int muxSelect, const uint32_t *values, int n)
             // for the default value
             lmx2594v0InitValues[muxSelect] = v & ~(0x8 | 0x4);
         }
-        lmx2594write(muxSelect, v);
+        stream[nStream++] = v;
+    }
+    if (!lmx2594writeStream(muxSelect, stream, nStream)) {
+        warn("LMX2594 (SPI MUX CHAN %d) -- register write failed", muxSelect);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Confirm that registers hold the values written
+ */
+static void
+verify2594(int muxSelect, const uint32_t *values, int n)
+{
+    static uint32_t readback[LMX2594_REGISTER_LIMIT];
+    struct lmx2594Stats *sp = &lmx2594Stats[muxSelect];
+    uint32_t expectedHash = 2166136261, readbackHash = 2166136261;
+    int i, nCheck = 0;
+
+    for (i = 0 ; (i < n) && (i < LMX2594_REGISTER_LIMIT) ; i++) {
+        uint32_t v = values[i] & 0x7FFFFF;
+        if (registerIsVerifiable(v >> 16)) {
+            expectedHash = hashWord(expectedHash, v);
+            readback[nCheck++] = v & 0x7F0000;
+        }
+    }
+    sp->isVerified = 0;
+    sp->expectedHash = expectedHash;
+    if (!lmx2594readStream(muxSelect, readback, nCheck)) {
+        sp->readbackHash = 0;
+        sp->verifyFailures++;
+        warn("LMX2594 (SPI MUX CHAN %d) -- register readback failed",
+                                                                    muxSelect);
+        return;
+    }
+    for (i = 0 ; i < nCheck ; i++) {
+        readbackHash = hashWord(readbackHash, readback[i]);
+    }
+    sp->readbackHash = readbackHash;
+    if (readbackHash == expectedHash) {
+        sp->isVerified = 1;
+    }
+    else {
+        sp->verifyFailures++;
+        warn("LMX2594 (SPI MUX CHAN %d) -- readback hash %08X, expected %08X",
+                                    muxSelect, (unsigned int)readbackHash,
+                                    (unsigned int)expectedHash);
     }
 }
 
@@ -78,8 +188,10 @@ init2594(int muxSelect, const uint32_t *values, int n)
 static void
 start2594(int muxSelect)
 {
+    struct lmx2594Stats *sp = &lmx2594Stats[muxSelect];
     int vTuneCode;
-    uint32_t v0 = lmx2594read(muxSelect, 0);
+    uint32_t v0 = read2594(muxSelect, 0);
+    uint32_t whenStarted, us;
 
     /*
      * Initiate VCO calibration
@@ -87,15 +199,24 @@ start2594(int muxSelect)
     lmx2594write(muxSelect, v0 | 0x8);
 
     /*
-     * Provide some time for things to settle down
+     * See if clock locks
      */
-    microsecondSpin(10000);
-
-    /*
-     * See if clock locked
-     */
-    vTuneCode = (lmx2594read(muxSelect, 110) >> 9) & 0x3;
-    if (vTuneCode != 2) {
+    whenStarted = MICROSECONDS_SINCE_BOOT();
+    for (;;) {
+        vTuneCode = (read2594(muxSelect, 110) >> 9) & 0x3;
+        us = MICROSECONDS_SINCE_BOOT() - whenStarted;
+        if ((vTuneCode == VTUNE_LOCKED) || (us >= LMX2594_LOCK_TIMEOUT_US)) {
+            break;
+        }
+    }
+    sp->lastLockUs = us;
+    if (vTuneCode == VTUNE_LOCKED) {
+        sp->isLocked = 1;
+        if (us > sp->maxLockUs) sp->maxLockUs = us;
+    }
+    else {
+        sp->isLocked = 0;
+        sp->lockFailures++;
         warn("LMX2594 (SPI MUX CHAN %d) -- VCO status: %s",
                                              muxSelect, vTuneNames[vTuneCode]);
     }
@@ -109,8 +230,20 @@ start2594(int muxSelect)
 void
 lmx2594Config(int muxSelect, const uint32_t *values, int n)
 {
-    init2594(muxSelect, values, n);
+    struct lmx2594Stats *sp = &lmx2594Stats[muxSelect];
+    uint32_t whenStarted = MICROSECONDS_SINCE_BOOT();
+
+    Xil_AssertVoid(muxSelect < SPI_MUX_CHANNEL_COUNT);
+    sp->configCount++;
+    if (init2594(muxSelect, values, n)) {
+        verify2594(muxSelect, values, n);
+    }
+    else {
+        sp->isVerified = 0;
+        sp->verifyFailures++;
+    }
     start2594(muxSelect);
+    sp->lastConfigUs = MICROSECONDS_SINCE_BOOT() - whenStarted;
 }
 
 void
@@ -136,9 +269,11 @@ lmx2594Readback(int muxSelect, uint32_t *values, int capacity)
     int i;
     int n = lmx2594Sizes[muxSelect];
     for (i = 0 ; (i < n) && (i < capacity) ; i++) {
-        int r = n - i - 1;
-        int v = lmx2594read(muxSelect, r);
-        *values++ = (r << 16) | (v & 0xFFFF);
+        values[i] = (n - i - 1) << 16;
+    }
+    if (!lmx2594readStream(muxSelect, values, i)) {
+        warn("LMX2594 (SPI MUX CHAN %d) -- register readback failed",
+                                                                    muxSelect);
     }
 
     /*
@@ -165,12 +300,28 @@ rfClkInit(void)
     }
 }
 
+static void
+showStats(int muxSelect)
+{
+    struct lmx2594Stats *sp = &lmx2594Stats[muxSelect];
+
+    printf("   Configurations: %u, last took %u us\n",
+                                            (unsigned int)sp->configCount,
+                                            (unsigned int)sp->lastConfigUs);
+    printf("        Lock time: %u us (max %u us)%s\n",
+                                            (unsigned int)sp->lastLockUs,
+                                            (unsigned int)sp->maxLockUs,
+                                            sp->isLocked ? "" : " NOT LOCKED");
+    printf("    Lock failures: %u\n", (unsigned int)sp->lockFailures);
+    printf("    Readback hash: %08X (%s)\n", (unsigned int)sp->readbackHash,
+                                    sp->isVerified ? "verified" : "MISMATCH");
+    printf("  Verify failures: %u\n", (unsigned int)sp->verifyFailures);
+}
+
 void
 rfClkShow(void)
 {
     int i, m, r, v;
-    static uint16_t chDiv[32] = {
-     2, 4, 6, 8, 12, 16, 24, 32, 48, 64, 72, 96, 128, 192, 256, 384, 512, 768};
 
     for (i = 0 ; i < LMX2594_MUX_SEL_SIZE ; i++) {
         m = lmx2594MuxSel[i];
@@ -222,6 +373,7 @@ rfClkShow(void)
         r = lmx2594read(m, 44);
         printf("          OUTA_PD: %x\n", (r >> 6) & 0x1);
         printf("          OUTB_PD: %x\n", (r >> 7) & 0x1);
+        showStats(m);
 
         /*
          * Configure STATUS pin to lock detect
@@ -244,7 +396,7 @@ lmx2594Status(void)
         int v0 = lmx2594v0InitValues[m];
         lmx2594write(m, v0 & ~0x4);
 
-        v |= ((lmx2594read(m, 110) >> 9) & 0x3) << (i * 4);
+        v |= ((read2594(m, 110) >> 9) & 0x3) << (i * 4);
 
         /*
          * Configure STATUS pin to lock detect
@@ -253,3 +405,345 @@ lmx2594Status(void)
     }
     return v;
 }
+
+/*
+ * One word per synthesizer:
+ *  Bits 19:0 -- Time from start of VCO calibration to lock (us)
+ *  Bit 28    -- Locked
+ *  Bit 29    -- Register readback matched values written
+ */
+int
+lmx2594FetchStatus(uint32_t *args)
+{
+    int i;
+
+    for (i = 0 ; i < LMX2594_MUX_SEL_SIZE ; i++) {
+        struct lmx2594Stats *sp = &lmx2594Stats[lmx2594MuxSel[i]];
+        uint32_t us = sp->lastLockUs;
+        if (us > 0xFFFFF) us = 0xFFFFF;
+        *args++ = (sp->isVerified << 29) | (sp->isLocked << 28) | us;
+    }
+    return LMX2594_MUX_SEL_SIZE;
+}
+
+/*
+ * Sampling clock reconfiguration
+ * Set the SYSREF divisors, retune the synthesizers, reprogram the ADC AXI
+ * clock MMCM, then restart, synchronize and calibrate the ADCs.
+ * Requests are carried out from the main loop since the sequence takes
+ * far too long to run in a network callback.
+ */
+static struct rfClkReconfig {
+    int                  pending;
+    int                  synthesizersOnly;
+    struct rfClkSettings current;
+    struct rfClkSettings requested;
+    uint32_t             lmx2594Values[LMX2594_REGISTER_LIMIT];
+    int                  lmx2594Count;
+    uint32_t             lmx2594Applied[LMX2594_REGISTER_LIMIT];
+    int                  lmx2594AppliedCount; /* 0 -- build-time tables */
+    uint32_t             count;
+    uint32_t             failCount;
+    uint32_t             lastMicroseconds;
+    const char          *status;
+} reconfig = {
+    .current = {
+        .samplingClkKHz = CFG_ADC_SAMPLING_CLK_FREQ * 1000,
+        .mmcmMultiplier = ADC_CLK_MMCM_MULTIPLIER,
+        .mmcmClk0Divider = ADC_CLK_MMCM_DIVIDER,
+        .mmcmClk1Divider = ADC_CLK_MMCM_CLK1_DIVIDER,
+        .adcClkPerSysref = ADC_CLK_PER_SYSREF,
+        .refClkPerSysref = REFCLK_OUT_PER_SYSREF },
+    .status = "None"
+};
+
+/*
+ * Synthesizer output frequency relative to its reference, from the
+ * OUTA settings in a complete set of TICS Pro register values.
+ * Return 0 if a field is missing or invalid.
+ */
+static double
+lmx2594OutputRatio(const uint32_t *values, int n)
+{
+    static const uint8_t needed[] = {9,10,11,12,34,36,38,39,42,43,45,75};
+    static int r[LMX2594_REGISTER_LIMIT];
+    int i, mult, pllR, pllRpre, outMux;
+    uint32_t num, den;
+    double ratio;
+
+    for (i = 0 ; i < LMX2594_REGISTER_LIMIT ; i++) {
+        r[i] = -1;
+    }
+    for (i = 0 ; i < n ; i++) {
+        r[(values[i] >> 16) & 0x7F] = values[i] & 0xFFFF;
+    }
+    for (i = 0 ; i < sizeof needed ; i++) {
+        if (r[needed[i]] < 0) return 0;
+    }
+    mult = (r[10] >> 7) & 0x1F;
+    pllR = (r[11] >> 4) & 0xFF;
+    pllRpre = r[12] & 0xFFF;
+    if ((mult == 0) || (pllR == 0) || (pllRpre == 0)) return 0;
+    ratio = (((r[9] >> 12) & 0x1) ? 2.0 : 1.0) * mult / (pllR * pllRpre);
+    num = (r[42] << 16) | r[43];
+    den = (r[38] << 16) | r[39];
+    ratio *= (((r[34] & 0x7) << 16) | r[36]) +
+                                        (den ? (double)num / den : 0.0);
+    outMux = (r[45] >> 11) & 0x3;
+    if (outMux == 0) {
+        int d = chDiv[(r[75] >> 6) & 0x1F];
+        if (d == 0) return 0;
+        ratio /= d;
+    }
+    else if (outMux != 1) {
+        return 0;
+    }
+    return ratio;
+}
+
+/*
+ * Check a request before anything is changed.
+ * Without register values the synthesizers keep their present
+ * settings so the sampling clock can't change.  With register values
+ * the sampling clock must be that produced by the new values given the
+ * reference implied by the present values and sampling clock.
+ */
+static const char *
+reconfigCheck(const struct rfClkSettings *sp)
+{
+    const uint32_t *oldValues;
+    int oldCount;
+    double oldRatio, newRatio, kHz, diff;
+
+    if (!rfADCsamplingClockValid(sp->samplingClkKHz)) {
+        return "Bad sampling clock";
+    }
+    if (!sysrefDivisorsValid(sp->adcClkPerSysref, sp->refClkPerSysref)) {
+        return "Bad SYSREF divisor";
+    }
+    if (!mmcmAdcClkValid(sp->mmcmMultiplier, sp->mmcmClk0Divider,
+                                             sp->mmcmClk1Divider)) {
+        return "Bad ADC clock MMCM setting";
+    }
+    if (reconfig.lmx2594Count == 0) {
+        if (sp->samplingClkKHz != reconfig.current.samplingClkKHz) {
+            return "Sampling clock change needs synthesizer values";
+        }
+        return NULL;
+    }
+    if (reconfig.lmx2594AppliedCount) {
+        oldValues = reconfig.lmx2594Applied;
+        oldCount = reconfig.lmx2594AppliedCount;
+    }
+    else {
+        oldValues = lmx2594Values[0];
+        oldCount = lmx2594Sizes[0];
+    }
+    oldRatio = lmx2594OutputRatio(oldValues, oldCount);
+    newRatio = lmx2594OutputRatio(reconfig.lmx2594Values,
+                                  reconfig.lmx2594Count);
+    if ((oldRatio == 0) || (newRatio == 0)) {
+        return "Incomplete synthesizer values";
+    }
+    kHz = reconfig.current.samplingClkKHz * (newRatio / oldRatio);
+    diff = kHz - sp->samplingClkKHz;
+    if (diff < 0) diff = -diff;
+    if (diff > (1 + kHz * 1e-5)) {
+        return "Sampling clock doesn't match synthesizer values";
+    }
+    return NULL;
+}
+
+/*
+ * Load new values into all synthesizers without touching the other
+ * sampling clock settings.  Like a reconfiguration this is carried out
+ * from the main loop.  Later reconfiguration requests are checked
+ * against these values.
+ * Return 0 if request accepted, -1 if not.
+ */
+int
+rfClkSynthesizerRequest(const uint32_t *values, int n)
+{
+    int i;
+
+    if ((n > LMX2594_REGISTER_LIMIT) || reconfig.pending) {
+        return -1;
+    }
+    for (i = 0 ; i < n ; i++) {
+        reconfig.lmx2594Values[i] = values[i];
+    }
+    reconfig.lmx2594Count = n;
+    reconfig.synthesizersOnly = 1;
+    reconfig.pending = 1;
+    return 0;
+}
+
+static void
+loadSynthesizers(void)
+{
+    int i;
+
+    lmx2594ConfigAllSame(reconfig.lmx2594Values, reconfig.lmx2594Count);
+    for (i = 0 ; i < reconfig.lmx2594Count ; i++) {
+        reconfig.lmx2594Applied[i] = reconfig.lmx2594Values[i];
+    }
+    reconfig.lmx2594AppliedCount = reconfig.lmx2594Count;
+}
+
+/*
+ * Arguments are the rfClkSettings members in order, optionally
+ * followed by LMX2594 register values in TICS Pro order.
+ * With no register values the synthesizers keep their present settings.
+ * Return 0 if request accepted, -1 if not.
+ */
+int
+rfClkReconfigureRequest(const uint32_t *args, int argc)
+{
+    struct rfClkSettings *sp = &reconfig.requested;
+    const char *err;
+    int i;
+
+    if ((argc < RFCLK_SETTINGS_COUNT)
+     || (argc > (RFCLK_SETTINGS_COUNT + LMX2594_REGISTER_LIMIT))
+     || reconfig.pending) {
+        return -1;
+    }
+    sp->samplingClkKHz = args[0];
+    sp->mmcmMultiplier = args[1];
+    sp->mmcmClk0Divider = args[2];
+    sp->mmcmClk1Divider = args[3];
+    sp->adcClkPerSysref = args[4];
+    sp->refClkPerSysref = args[5];
+    reconfig.lmx2594Count = argc - RFCLK_SETTINGS_COUNT;
+    for (i = 0 ; i < reconfig.lmx2594Count ; i++) {
+        reconfig.lmx2594Values[i] = args[RFCLK_SETTINGS_COUNT + i];
+    }
+    if ((err = reconfigCheck(sp)) != NULL) {
+        reconfig.status = err;
+        return -1;
+    }
+    reconfig.pending = 1;
+    reconfig.status = "Pending";
+    return 0;
+}
+
+/*
+ * Put back the settings in use before a failed reconfiguration
+ */
+static void
+reconfigRestore(int synthesizersChanged)
+{
+    const struct rfClkSettings *cp = &reconfig.current;
+    int i;
+
+    sysrefSetDivisors(cp->adcClkPerSysref, cp->refClkPerSysref);
+    if (synthesizersChanged) {
+        if (reconfig.lmx2594AppliedCount) {
+            lmx2594ConfigAllSame(reconfig.lmx2594Applied,
+                                 reconfig.lmx2594AppliedCount);
+        }
+        else {
+            for (i = 0 ; i < LMX2594_MUX_SEL_SIZE ; i++) {
+                lmx2594Config(lmx2594MuxSel[i], lmx2594Values[i],
+                                                lmx2594Sizes[i]);
+            }
+        }
+    }
+    if (mmcmConfigureAdcClk(cp->mmcmMultiplier, cp->mmcmClk0Divider,
+                                                cp->mmcmClk1Divider) < 0) {
+        warn("Critical -- can't restore ADC clock MMCM settings");
+    }
+    afeADCrestart();
+}
+
+static int
+reconfigure(const struct rfClkSettings *sp)
+{
+    const char *err;
+    int i;
+
+    if ((err = reconfigCheck(sp)) != NULL) {
+        reconfig.status = err;
+        return -1;
+    }
+    sysrefSetDivisors(sp->adcClkPerSysref, sp->refClkPerSysref);
+    if (reconfig.lmx2594Count) {
+        lmx2594ConfigAllSame(reconfig.lmx2594Values, reconfig.lmx2594Count);
+        for (i = 0 ; i < LMX2594_MUX_SEL_SIZE ; i++) {
+            if (!lmx2594Stats[lmx2594MuxSel[i]].isLocked) {
+                reconfig.status = "Synthesizer won't lock";
+                reconfigRestore(1);
+                return -1;
+            }
+        }
+    }
+    if (mmcmConfigureAdcClk(sp->mmcmMultiplier, sp->mmcmClk0Divider,
+                                                sp->mmcmClk1Divider) < 0) {
+        reconfig.status = "ADC clock MMCM won't lock";
+        reconfigRestore(reconfig.lmx2594Count != 0);
+        return -1;
+    }
+    if (reconfig.lmx2594Count) {
+        for (i = 0 ; i < reconfig.lmx2594Count ; i++) {
+            reconfig.lmx2594Applied[i] = reconfig.lmx2594Values[i];
+        }
+        reconfig.lmx2594AppliedCount = reconfig.lmx2594Count;
+    }
+    rfADCsetSamplingClock(sp->samplingClkKHz / 1000.0);
+    afeADCrestart();
+    reconfig.status = "Complete";
+    return 0;
+}
+
+void
+rfClkCrank(void)
+{
+    uint32_t whenStarted;
+
+    if (!reconfig.pending) return;
+    if (reconfig.synthesizersOnly) {
+        loadSynthesizers();
+        reconfig.synthesizersOnly = 0;
+        reconfig.pending = 0;
+        return;
+    }
+    whenStarted = MICROSECONDS_SINCE_BOOT();
+    printf("Reconfigure ADC sampling clock to %u kHz.\n",
+                            (unsigned int)reconfig.requested.samplingClkKHz);
+    reconfig.count++;
+    if (reconfigure(&reconfig.requested) == 0) {
+        reconfig.current = reconfig.requested;
+    }
+    else {
+        reconfig.failCount++;
+        warn("Sampling clock reconfiguration failed: %s", reconfig.status);
+    }
+    reconfig.lastMicroseconds = MICROSECONDS_SINCE_BOOT() - whenStarted;
+    reconfig.pending = 0;
+    rfClkShowSamplingClock();
+}
+
+void
+rfClkShowSamplingClock(void)
+{
+    const struct rfClkSettings *sp = &reconfig.current;
+
+    printf("ADC sampling clock: %u kHz (measured %u kHz)\n",
+                                        (unsigned int)sp->samplingClkKHz,
+                                        rfADCsamplingClockKHz());
+    printf("    MMCM multiplier: %d.%03d\n", (int)sp->mmcmMultiplier / 1000,
+                                             (int)sp->mmcmMultiplier % 1000);
+    printf("  MMCM CLK0 divider: %d.%03d\n", (int)sp->mmcmClk0Divider / 1000,
+                                             (int)sp->mmcmClk0Divider % 1000);
+    printf("  MMCM CLK1 divider: %d\n", (int)sp->mmcmClk1Divider / 1000);
+    printf(" ADC clk per SYSREF: %d\n", (int)sp->adcClkPerSysref);
+    printf(" REF clk per SYSREF: %d\n", (int)sp->refClkPerSysref);
+    printf("    Reconfiguration: %s (%u, %u failed", reconfig.status,
+                                            (unsigned int)reconfig.count,
+                                            (unsigned int)reconfig.failCount);
+    if (reconfig.count) {
+        printf(", last took %u ms",
+                               (unsigned int)reconfig.lastMicroseconds / 1000);
+    }
+    printf(")\n");
+}
@@ -4,6 +4,22 @@
 #ifndef _RFCLK_H_
 #define _RFCLK_H_
 
+#include <stdint.h>
+
+/*
+ * Sampling clock configuration
+ * MMCM values are scaled by a factor of 1000.
+ */
+struct rfClkSettings {
+    uint32_t samplingClkKHz;
+    uint32_t mmcmMultiplier;
+    uint32_t mmcmClk0Divider;
+    uint32_t mmcmClk1Divider;
+    uint32_t adcClkPerSysref;
+    uint32_t refClkPerSysref;
+};
+#define RFCLK_SETTINGS_COUNT 6
+
 void rfClkInit(void);
 void rfClkInit04208(void);
 void rfClkShow(void);
@@ -12,5 +28,10 @@ void lmx2594ConfigAllSame(const uint32_t *values, int n);
 int lmx2594Readback(int muxSelect, uint32_t *values, int capacity);
 int lmx2594ReadbackFirst(uint32_t *values, int capacity);
 int lmx2594Status(void);
+int lmx2594FetchStatus(uint32_t *args);
+int rfClkSynthesizerRequest(const uint32_t *values, int n);
+int rfClkReconfigureRequest(const uint32_t *args, int argc);
+void rfClkCrank(void);
+void rfClkShowSamplingClock(void);
 
 #endif  /* _RFCLK_H_ */
@@ -9,26 +9,83 @@
 #define SYSREF_CSR_REF_CLK_FAULT            (1 << 15)
 #define SYSREF_CSR_REF_CLK_DIVISOR_SHIFT    0
 
+/*
+ * Must match COUNTER_WIDTH in sysrefSync.v
+ */
+#define SYSREF_COUNTER_WIDTH                8
+#define SYSREF_DIVISOR_LIMIT                (1 << SYSREF_COUNTER_WIDTH)
+#define SYSREF_COUNT_MASK                   (SYSREF_DIVISOR_LIMIT - 1)
+#define SYSREF_ADC_CLK_COUNT(v) \
+        ((((v) >> SYSREF_CSR_ADC_CLK_DIVISOR_SHIFT) & SYSREF_COUNT_MASK) + 1)
+#define SYSREF_REF_CLK_COUNT(v) \
+        ((((v) >> SYSREF_CSR_REF_CLK_DIVISOR_SHIFT) & SYSREF_COUNT_MASK) + 1)
+
+/*
+ * Faults seen since the last sysrefIsStable() call.
+ * Kept here since sysrefShow clears the hardware fault flags.
+ */
+static uint32_t faultsSeen;
+
+/*
+ * Divisors start with build-time values but may be changed
+ * when the sampling clock is reconfigured.
+ */
+static int adcClkPerSysref = ADC_CLK_PER_SYSREF;
+static int refClkPerSysref = REFCLK_OUT_PER_SYSREF;
+
 void
 sysrefInit(void)
 {
     GPIO_WRITE(GPIO_IDX_SYSREF_CSR,
-               ((ADC_CLK_PER_SYSREF-1) << SYSREF_CSR_ADC_CLK_DIVISOR_SHIFT) |
-               ((REFCLK_OUT_PER_SYSREF-1) << SYSREF_CSR_REF_CLK_DIVISOR_SHIFT));
+               ((adcClkPerSysref-1) << SYSREF_CSR_ADC_CLK_DIVISOR_SHIFT) |
+               ((refClkPerSysref-1) << SYSREF_CSR_REF_CLK_DIVISOR_SHIFT));
     GPIO_WRITE(GPIO_IDX_SYSREF_CSR, SYSREF_CSR_ADC_CLK_FAULT |
                                     SYSREF_CSR_REF_CLK_FAULT);
 }
 
+/*
+ * Return 1 if both divisors fit the counters
+ */
+int
+sysrefDivisorsValid(int adcClk, int refClk)
+{
+    return (adcClk >= 1) && (adcClk <= SYSREF_DIVISOR_LIMIT)
+        && (refClk >= 1) && (refClk <= SYSREF_DIVISOR_LIMIT);
+}
+
+/*
+ * Return 0 on success, -1 if a divisor won't fit the counters
+ */
+int
+sysrefSetDivisors(int adcClk, int refClk)
+{
+    if (!sysrefDivisorsValid(adcClk, refClk)) {
+        return -1;
+    }
+    adcClkPerSysref = adcClk;
+    refClkPerSysref = refClk;
+    sysrefInit();
+    return 0;
+}
+
+void
+sysrefGetDivisors(int *adcClk, int *refClk)
+{
+    *adcClk = adcClkPerSysref;
+    *refClk = refClkPerSysref;
+}
+
 void
 sysrefShow(void)
 {
     uint32_t v = GPIO_READ(GPIO_IDX_SYSREF_CSR);
     printf("%d ADC AXI clocks per SYSREF (expect %d).\n",
-                           ((v >> SYSREF_CSR_ADC_CLK_DIVISOR_SHIFT) & 0x3FF) + 1,
-                           ADC_CLK_PER_SYSREF);
+                           SYSREF_ADC_CLK_COUNT(v),
+                           adcClkPerSysref);
     printf("%d FPGA_REFCLK_OUT_C clocks per SYSREF (expect %d).\n",
-                           ((v >> SYSREF_CSR_REF_CLK_DIVISOR_SHIFT) & 0x3FF) + 1,
-                           REFCLK_OUT_PER_SYSREF);
+                           SYSREF_REF_CLK_COUNT(v),
+                           refClkPerSysref);
+    faultsSeen |= v & (SYSREF_CSR_ADC_CLK_FAULT | SYSREF_CSR_REF_CLK_FAULT);
     if (v & SYSREF_CSR_ADC_CLK_FAULT) {
         print("ADC AXI SYSREF fault.\n");
         GPIO_WRITE(GPIO_IDX_SYSREF_CSR, SYSREF_CSR_ADC_CLK_FAULT);
@@ -38,3 +95,25 @@ sysrefShow(void)
         GPIO_WRITE(GPIO_IDX_SYSREF_CSR, SYSREF_CSR_REF_CLK_FAULT);
     }
 }
+
+/*
+ * Return 1 if SYSREF has arrived at the expected intervals in both clock
+ * domains since the previous call, in which case the converter tiles
+ * can not have slipped relative to each other.
+ */
+int
+sysrefIsStable(void)
+{
+    uint32_t v = GPIO_READ(GPIO_IDX_SYSREF_CSR);
+    uint32_t faults;
+
+    faults = faultsSeen |
+             (v & (SYSREF_CSR_ADC_CLK_FAULT | SYSREF_CSR_REF_CLK_FAULT));
+    faultsSeen = 0;
+    if (faults) {
+        GPIO_WRITE(GPIO_IDX_SYSREF_CSR, faults);
+        return 0;
+    }
+    return (SYSREF_ADC_CLK_COUNT(v) == adcClkPerSysref)
+        && (SYSREF_REF_CLK_COUNT(v) == refClkPerSysref);
+}
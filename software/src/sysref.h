@@ -6,5 +6,9 @@
 
 void sysrefInit(void);
 void sysrefShow(void);
+int sysrefIsStable(void);
+int sysrefDivisorsValid(int adcClk, int refClk);
+int sysrefSetDivisors(int adcClk, int refClk);
+void sysrefGetDivisors(int *adcClk, int *refClk);
 
 #endif  /* _SYSREF_H_ */
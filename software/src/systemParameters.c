@@ -1,4 +1,6 @@
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <xil_io.h>
 #include <lwip/def.h>
 #include <stdbool.h>
@@ -51,6 +53,58 @@ void systemParametersUpdateChecksum(struct systemParameters *sysParams)
     sysParams->checksum = checksum(sysParams);
 }
 
+/*
+ * Binary EEPROM record
+ * Fields may be added to struct systemParameters just ahead of its
+ * checksum member, which is not stored.  Those absent from an older,
+ * shorter record keep their default values.  Change the version if
+ * the meaning or position of an existing field changes.
+ */
+#define RECORD_MAGIC    0x53595350  /* "SYSP" */
+#define RECORD_VERSION  1
+#define RECORD_LENGTH   offsetof(struct systemParameters, checksum)
+
+struct systemParametersRecord {
+    uint32_t                magic;
+    uint16_t                version;
+    uint16_t                length;     /* Bytes of parameters */
+    uint32_t                checksum;   /* Of parameters */
+    struct systemParameters parameters;
+};
+
+/*
+ * Copy of EEPROM contents so that only changed pages need be written
+ */
+static struct systemParametersRecord eepromRecord;
+static int eepromRecordIsValid;
+
+static uint32_t
+recordChecksum(const struct systemParametersRecord *rp, int length)
+{
+    int i;
+    uint32_t sum = RECORD_MAGIC;
+    const unsigned char *cp = (const unsigned char *)&rp->parameters;
+
+    for (i = 0 ; i < length ; i++) {
+        sum = (sum << 5) + (sum >> 27) + cp[i] + i;
+    }
+    return sum;
+}
+
+static int
+readRecord(void)
+{
+    eepromRecordIsValid = eepromRead(EEPROM_SYSTEM_PARAMETERS_ADDRESS,
+                                     &eepromRecord, sizeof eepromRecord);
+    return eepromRecordIsValid
+        && (eepromRecord.magic == RECORD_MAGIC)
+        && (eepromRecord.version == RECORD_VERSION)
+        && (eepromRecord.length <= RECORD_LENGTH)
+        && ((eepromRecord.length % sizeof(uint32_t)) == 0)
+        && (recordChecksum(&eepromRecord, eepromRecord.length) ==
+                                                    eepromRecord.checksum);
+}
+
 void
 systemParametersSetDefaults(void)
 {
@@ -67,6 +121,7 @@ systemParametersSetDefaults(void)
     systemParametersDefault.netConfig = netDefault;
     systemParametersDefault.userMGTrefClkOffsetPPM = 0;
     systemParametersDefault.startupDebugFlags = 0;
+    systemParametersDefault.adcTargetLatency = 0;
 }
 
 /*
@@ -77,17 +132,25 @@ systemParametersSetDefaults(void)
 void
 systemParametersCommit(void)
 {
+    int oldTargetLatency = systemParameters.adcTargetLatency;
+
     if (checksum(&systemParametersCandidate) != systemParametersCandidate.checksum) {
         printf("\n====== ASSIGNING DEFAULT PARAMETERS ===\n\n");
         systemParametersCandidate = systemParametersDefault;
+        systemParameters = systemParametersCandidate;
+    }
+    else {
+        systemParameters = systemParametersCandidate;
+        systemParametersWriteEEPROM();
     }
-
-    systemParameters = systemParametersCandidate;
     debugFlags = systemParameters.startupDebugFlags;
 
     if (userMGTrefClkAdjust(systemParameters.userMGTrefClkOffsetPPM)) {
         systemParametersShowUserMGTrefClkOffsetPPM();
     }
+    if (systemParameters.adcTargetLatency != oldTargetLatency) {
+        rfADCsync();
+    }
 }
 
 /*
@@ -98,6 +161,7 @@ static struct conv {
     size_t      offset;
     size_t      size;
     bool        visited;
+    bool        optional;       /* Keeps default value if absent */
     char     *(*format)(const void *val, size_t num);
     int       (*parse)(const char *str, void *val);
 } conv[] = {
@@ -157,6 +221,15 @@ static struct conv {
         .format = formatHex,
         .parse = parseHex,
     },
+    {
+        .name = "ADC target latency",
+        .offset = offsetof(struct systemParameters, adcTargetLatency),
+        .size = member_size(struct systemParameters, adcTargetLatency),
+        .visited = false,
+        .optional = true,
+        .format = formatInt,
+        .parse = parseInt,
+    },
 };
 
 /*
@@ -205,7 +278,7 @@ searchConvFirstNonVisited(struct conv *cnv, size_t size)
     int i = 0;
 
     for (i = 0; i < size; ++i) {
-        if (!cnv[i].visited){
+        if (!cnv[i].visited && !cnv[i].optional){
             return i;
         }
     }
@@ -231,7 +304,70 @@ systemParametersGetTable(unsigned char *buf, int capacity,
 }
 
 /*
- * EEPROM I/O
+ * Read parameters from EEPROM at startup
+ * Fall back to the file system copy written by earlier firmware if
+ * there's no valid EEPROM record.  The commit that follows will then
+ * store the parameters in EEPROM.
+ */
+int
+systemParametersReadEEPROM(void)
+{
+    if (!readRecord()) {
+        printf("No system parameters in EEPROM -- trying %s.\n",
+                                                    SYSTEM_PARAMETERS_NAME);
+        return systemParametersStashEEPROM();
+    }
+    systemParametersCandidate = systemParametersDefault;
+    memcpy(&systemParametersCandidate, &eepromRecord.parameters,
+                                                        eepromRecord.length);
+    systemParametersUpdateChecksum(&systemParametersCandidate);
+    return eepromRecord.length;
+}
+
+/*
+ * Write parameters to EEPROM
+ * Only pages whose contents differ from the last values read or
+ * written are sent to the device.
+ * Return number of pages written, or -1 on failure.
+ */
+int
+systemParametersWriteEEPROM(void)
+{
+    struct systemParametersRecord record;
+    const unsigned char *newp = (const unsigned char *)&record;
+    const unsigned char *oldp = (const unsigned char *)&eepromRecord;
+    int offset = 0, pageCount = 0;
+
+    systemParametersUpdateChecksum(&systemParameters);
+    memset(&record, 0, sizeof record);
+    record.magic = RECORD_MAGIC;
+    record.version = RECORD_VERSION;
+    record.length = RECORD_LENGTH;
+    record.parameters = systemParameters;
+    record.checksum = recordChecksum(&record, record.length);
+    if (!eepromRecordIsValid) readRecord();
+    while (offset < sizeof record) {
+        int address = EEPROM_SYSTEM_PARAMETERS_ADDRESS + offset;
+        int n = EEPROM_PAGE_SIZE - (address % EEPROM_PAGE_SIZE);
+        if (n > (sizeof record - offset)) n = sizeof record - offset;
+        if (!eepromRecordIsValid
+         || (memcmp(newp + offset, oldp + offset, n) != 0)) {
+            if (!eepromWrite(address, newp + offset, n)) {
+                warn("System parameters EEPROM write failed");
+                eepromRecordIsValid = 0;
+                return -1;
+            }
+            pageCount++;
+        }
+        offset += n;
+    }
+    eepromRecord = record;
+    eepromRecordIsValid = 1;
+    return pageCount;
+}
+
+/*
+ * Generate file for TFTP transfer
  */
 int
 systemParametersFetchEEPROM(void)
@@ -340,7 +476,10 @@ systemParametersSetTable(struct systemParameters *sysParams,
         const unsigned char *buf, int size)
 {
     char *err = "";
-    int i = parseTable(sysParams, buf, size, &err);
+    int i;
+
+    *sysParams = systemParametersDefault;
+    i = parseTable(sysParams, buf, size, &err);
 
     if (i <= 0) {
         printf("Bad file contents at line %d: %s\n", -i, err);
@@ -28,6 +28,7 @@ extern struct systemParameters {
     struct sysNetConfig netConfig;
     int                 userMGTrefClkOffsetPPM;
     int                 startupDebugFlags;
+    int                 adcTargetLatency;
     uint32_t            checksum;
 } systemParameters;
 
@@ -35,6 +36,8 @@ extern struct systemParameters {
 void systemParametersSetDefaults(void);
 int systemParametersFetchEEPROM(void);
 int systemParametersStashEEPROM(void);
+int systemParametersReadEEPROM(void);
+int systemParametersWriteEEPROM(void);
 void systemParametersCommit(void);
 
 void setDefaultNetAddress(struct sysNetConfig *netConfig,
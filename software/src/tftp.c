@@ -3,14 +3,22 @@
  *
  * Strictly speaking TFTP is limited to 32 MB, but this server will transfer
  * larger files with clients that wrap around from block 65535 to block 0.
+ *
+ * Supports the blksize (RFC 2348) and windowsize (RFC 7440) options.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <lwip/udp.h>
+#include "bootImage.h"
+#include "eventLogger.h"
+#include "eyescan.h"
 #include "ffs.h"
+#include "gpio.h"
 #include "st7789v.h"
 #include "tftp.h"
+#include "trace.h"
 #include "util.h"
 #include "afe.h"
 #include "systemParameters.h"
@@ -22,9 +30,28 @@
 #define TFTP_OPCODE_DATA  3
 #define TFTP_OPCODE_ACK   4
 #define TFTP_OPCODE_ERROR 5
+#define TFTP_OPCODE_OACK  6
 
 #define TFTP_ERROR_ACCESS_VIOLATION 2
 
+#define TFTP_BLKSIZE_DEFAULT    512
+#define TFTP_BLKSIZE_MIN        8
+#define TFTP_BLKSIZE_MAX        1468    /* Fits a standard Ethernet frame */
+#define TFTP_WINDOWSIZE_DEFAULT 1
+#define TFTP_WINDOWSIZE_MAX     32
+
+/*
+ * Incoming data is accumulated and written to the file system in large chunks.
+ * Only one file may be received at a time so the buffer is shared.
+ */
+#define TFTP_WRITE_BUFFER_SIZE  (64 * 1024)
+
+/*
+ * Concurrent transfers
+ */
+#define TFTP_SESSION_COUNT      4
+#define TFTP_SESSION_TIMEOUT_US 10000000
+
 struct fileInfo {
     const char *name;
     const char *description;
@@ -32,6 +59,10 @@ struct fileInfo {
     int       (*postReceive)(void);
     void      (*commit)(void);
     void      (*defaults)(void);
+    const char *(*preReceive)(const char *name);
+    void      (*receiveData)(const char *buf, int n);
+    int       (*readback)(void);  /* Startup, if not postReceive */
+    void      (*abort)(void);     /* Receive did not complete */
 };
 
 static int dummyPreTransmit(void)
@@ -52,23 +83,43 @@ static struct fileInfo fileTable[] = {
                                                     st7789vGrabScreen,
                                                     dummyPostReceive,
                                                     dummyCommit},
+   {EYESCAN_FILE_NAME, "Transceiver eye scan",
+                                                    eyescanFetchFile,
+                                                    dummyPostReceive,
+                                                    dummyCommit},
+   {EVENT_LOGGER_FILE_NAME, "Timing system event log",
+                                                    eventLoggerFetchFile,
+                                                    dummyPostReceive,
+                                                    dummyCommit},
+   {TRACE_FILE_NAME, "Diagnostic trace",
+                                                    traceFetchFile,
+                                                    dummyPostReceive,
+                                                    dummyCommit},
    {SYSTEM_PARAMETERS_NAME, "System parameters",
                                                     systemParametersFetchEEPROM,
                                                     systemParametersStashEEPROM,
                                                     systemParametersCommit,
-                                                    systemParametersCommit},
+                                                    systemParametersCommit,
+                                                    NULL,
+                                                    NULL,
+                                                    systemParametersReadEEPROM},
    {AFE_EEPROM_NAME, "AFE EEPROM",
                                                     afeFetchEEPROM,
                                                     afeStashEEPROM,
                                                     dummyCommit,
                                                     dummyCommit},
-   {"BOOT.bin", "Bitsream + Software image",
+   {BOOT_IMAGE_NAME, "Bitsream + Software image",
                                                     dummyPreTransmit,
-                                                    dummyPostReceive,
-                                                    dummyCommit},
+                                                    bootImagePostReceive,
+                                                    bootImageCommit,
+                                                    NULL,
+                                                    bootImagePreReceive,
+                                                    bootImageReceiveData,
+                                                    NULL,
+                                                    bootImageAbort},
 };
 
-#define FILE_TABLE_SIZE ((sizeof fileTable / sizeof fileTable[0]))
+#define FILE_TABLE_SIZE ((int)(sizeof fileTable / sizeof fileTable[0]))
 
 /*
  * Send an error reply
@@ -117,48 +168,336 @@ replyACK(struct udp_pcb *pcb, const ip_addr_t *fromAddr, u16_t fromPort,
     pbuf_free(p);
 }
 
+/*
+ * Transfer state, one per client address and port
+ */
+struct tftpSession {
+    int         inUse;
+    ip_addr_t   addr;
+    u16_t       port;
+    uint32_t    usAtLastActivity;
+    int         fileIndex;
+    FIL         fil, *fp;
+    int         isRead;
+    int         blksize;
+    int         windowsize;
+
+    /* Receive */
+    u16_t       lastBlock;
+    int         blocksSinceAck;
+    int         gapAcked;
+    int         wbufCount;
+    char       *wbuf;
+
+    /* Transmit */
+    uint32_t    blocksAcked;
+    int         windowCount;
+    int         lastSend;
+};
+static struct tftpSession sessions[TFTP_SESSION_COUNT];
+static char writeBuffer[TFTP_WRITE_BUFFER_SIZE];
+static struct tftpSession *writeBufferOwner;
+
+static void
+abortReceive(int fileIndex)
+{
+    void (*funcAbort)(void) = fileTable[fileIndex].abort;
+    if (funcAbort) {
+        (*funcAbort)();
+    }
+}
+
+/*
+ * A receive session that ends with its file still open did not complete
+ */
+static void
+sessionEnd(struct tftpSession *sp)
+{
+    if (sp->fp) {
+        f_close(sp->fp);
+        sp->fp = NULL;
+        if (!sp->isRead && (sp->fileIndex >= 0)) {
+            abortReceive(sp->fileIndex);
+        }
+    }
+    if (writeBufferOwner == sp) {
+        writeBufferOwner = NULL;
+    }
+    sp->wbuf = NULL;
+    sp->fileIndex = -1;
+    sp->inUse = 0;
+}
+
+/*
+ * Release sessions whose client has gone quiet
+ */
+static void
+sessionExpire(void)
+{
+    struct tftpSession *sp;
+    uint32_t now = MICROSECONDS_SINCE_BOOT();
+
+    for (sp = sessions ; sp < &sessions[TFTP_SESSION_COUNT] ; sp++) {
+        if (sp->inUse
+         && ((uint32_t)(now - sp->usAtLastActivity) > TFTP_SESSION_TIMEOUT_US)) {
+            TRACE(DEBUGFLAG_TFTP, TRACE_TFTP_TIMEOUT, sp - sessions, 0, 0, 0);
+            sessionEnd(sp);
+        }
+    }
+}
+
+/*
+ * Called from main loop
+ */
+void
+tftpCrank(void)
+{
+    sessionExpire();
+}
+
+static struct tftpSession *
+sessionFind(const ip_addr_t *fromAddr, u16_t fromPort)
+{
+    struct tftpSession *sp;
+
+    for (sp = sessions ; sp < &sessions[TFTP_SESSION_COUNT] ; sp++) {
+        if (sp->inUse
+         && (sp->port == fromPort)
+         && ip_addr_cmp(&sp->addr, fromAddr)) {
+            sp->usAtLastActivity = MICROSECONDS_SINCE_BOOT();
+            return sp;
+        }
+    }
+    return NULL;
+}
+
+static struct tftpSession *
+sessionNew(const ip_addr_t *fromAddr, u16_t fromPort)
+{
+    struct tftpSession *sp;
+
+    sessionExpire();
+    sp = sessionFind(fromAddr, fromPort);
+    if (sp) {
+        sessionEnd(sp);
+    }
+    for (sp = sessions ; sp < &sessions[TFTP_SESSION_COUNT] ; sp++) {
+        if (!sp->inUse) {
+            sp->inUse = 1;
+            ip_addr_copy(sp->addr, *fromAddr);
+            sp->port = fromPort;
+            sp->usAtLastActivity = MICROSECONDS_SINCE_BOOT();
+            sp->fileIndex = -1;
+            sp->fp = NULL;
+            return sp;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * A file may be involved in only one transfer at a time
+ */
+static int
+fileIsBusy(int fileIndex)
+{
+    struct tftpSession *sp;
+
+    for (sp = sessions ; sp < &sessions[TFTP_SESSION_COUNT] ; sp++) {
+        if (sp->inUse && (sp->fileIndex == fileIndex)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Send an option acknowledgement
+ */
+#define OPTION_BLKSIZE      0x1
+#define OPTION_WINDOWSIZE   0x2
+static void
+replyOACK(struct udp_pcb *pcb, struct tftpSession *sp, int options)
+{
+    char cbuf[64];
+    int l = 0;
+    struct pbuf *p;
+
+    cbuf[l++] = TFTP_OPCODE_OACK >> 8;
+    cbuf[l++] = TFTP_OPCODE_OACK & 0xFF;
+    if (options & OPTION_BLKSIZE) {
+        l += sprintf(cbuf + l, "blksize") + 1;
+        l += sprintf(cbuf + l, "%d", sp->blksize) + 1;
+    }
+    if (options & OPTION_WINDOWSIZE) {
+        l += sprintf(cbuf + l, "windowsize") + 1;
+        l += sprintf(cbuf + l, "%d", sp->windowsize) + 1;
+    }
+    p = pbuf_alloc(PBUF_TRANSPORT, l, PBUF_RAM);
+    if (p == NULL) {
+        printf("Can't allocate TFTP OACK pbuf\n");
+        return;
+    }
+    memcpy(p->payload, cbuf, l);
+    udp_sendto(pcb, p, &sp->addr, sp->port);
+    pbuf_free(p);
+}
+
 /*
  * Send a data packet
+ * Return number of bytes sent or -1 on file system error
  */
 static int
-sendBlock(struct udp_pcb *pcb, const ip_addr_t *fromAddr, u16_t fromPort,
-                                                             int block, FIL *fp)
+sendBlock(struct udp_pcb *pcb, struct tftpSession *sp, int block)
 {
     int n;
     unsigned int l;
     struct pbuf *p;
     u16_t *p16;
-    static char cbuf[512];
-    static int lastCount;
+    static char cbuf[TFTP_BLKSIZE_MAX];
+    UINT nRead;
+    FRESULT fr;
 
-    if (fp == NULL) {
-        n = lastCount;
+    fr = f_read(sp->fp, cbuf, sp->blksize, &nRead);
+    if (fr != FR_OK) {
+        replyERR(pcb, &sp->addr, sp->port, ffsStrerror(fr));
+        return -1;
     }
-    else {
-        UINT nRead;
-        FRESULT fr = f_read(fp, cbuf, sizeof cbuf, &nRead);
-        if (fr != FR_OK) {
-            replyERR(pcb, fromAddr, fromPort, ffsStrerror(fr));
-            return 0;
-        }
-        n = nRead;
-    }
-    lastCount = n;
+    n = nRead;
     l = (2 * sizeof(u16_t)) + n;
     p = pbuf_alloc(PBUF_TRANSPORT, l, PBUF_RAM);
     if (p == NULL) {
         printf("Can't allocte TFTP DATA pbuf\n");
-        return 0;
+        return n;
     }
     p16 = (u16_t*)p->payload;
     *p16++ = htons(TFTP_OPCODE_DATA);
     *p16++ = htons(block);
     memcpy(p16, cbuf, n);
-    udp_sendto(pcb, p, fromAddr, fromPort);
+    udp_sendto(pcb, p, &sp->addr, sp->port);
     pbuf_free(p);
     return n;
 }
 
+/*
+ * Send a window of data packets following the last acknowledged block
+ * Return 0 on success, -1 on file system error
+ */
+static int
+sendWindow(struct udp_pcb *pcb, struct tftpSession *sp)
+{
+    int i, n = 0;
+    FSIZE_t offset = (FSIZE_t)sp->blocksAcked * sp->blksize;
+    FRESULT fr;
+
+    if (f_tell(sp->fp) != offset) {
+        fr = f_lseek(sp->fp, offset);
+        if (fr != FR_OK) {
+            replyERR(pcb, &sp->addr, sp->port, ffsStrerror(fr));
+            return -1;
+        }
+    }
+    sp->windowCount = 0;
+    for (i = 0 ; i < sp->windowsize ; i++) {
+        n = sendBlock(pcb, sp, (u16_t)(sp->blocksAcked + 1 + i));
+        if (n < 0) {
+            return -1;
+        }
+        sp->windowCount++;
+        if (n < sp->blksize) {
+            break;
+        }
+    }
+    sp->lastSend = n;
+    return 0;
+}
+
+/*
+ * Write buffered data to file system
+ */
+static FRESULT
+flushWriteBuffer(struct tftpSession *sp)
+{
+    UINT nWritten;
+    FRESULT fr;
+
+    if (sp->wbufCount == 0) {
+        return FR_OK;
+    }
+    fr = f_write(sp->fp, sp->wbuf, sp->wbufCount, &nWritten);
+    if ((fr == FR_OK) && ((int)nWritten != sp->wbufCount)) {
+        /* Volume full */
+        fr = FR_DENIED;
+    }
+    if ((fr != FR_OK) && (debugFlags & DEBUGFLAG_TFTP)) {
+        printf("Write failed %s %d!=%d\n", ffsStrerror(fr), (int)nWritten,
+                                                             sp->wbufCount);
+    }
+    sp->wbufCount = 0;
+    return fr;
+}
+
+static FRESULT
+bufferedWrite(struct tftpSession *sp, const char *cp, int n)
+{
+    FRESULT fr;
+
+    if ((sp->wbufCount + n) > TFTP_WRITE_BUFFER_SIZE) {
+        fr = flushWriteBuffer(sp);
+        if (fr != FR_OK) {
+            return fr;
+        }
+    }
+    memcpy(sp->wbuf + sp->wbufCount, cp, n);
+    sp->wbufCount += n;
+    return FR_OK;
+}
+
+/*
+ * Process request options
+ * Return bitmap of options to be acknowledged
+ */
+static int
+parseOptions(struct tftpSession *sp, const char *cp, int len)
+{
+    int i = 0, options = 0;
+
+    sp->blksize = TFTP_BLKSIZE_DEFAULT;
+    sp->windowsize = TFTP_WINDOWSIZE_DEFAULT;
+    while (i < len) {
+        const char *name, *value, *nul;
+        int v;
+
+        name = cp + i;
+        nul = memchr(name, '\0', len - i);
+        if (nul == NULL) break;
+        i = nul - cp + 1;
+        value = cp + i;
+        nul = memchr(value, '\0', len - i);
+        if (nul == NULL) break;
+        i = nul - cp + 1;
+        v = strtol(value, NULL, 10);
+        if (debugFlags & DEBUGFLAG_TFTP) {
+            printf("OPTION:%s  VALUE:%s\n", name, value);
+        }
+        if (strcasecmp(name, "blksize") == 0) {
+            if (v >= TFTP_BLKSIZE_MIN) {
+                if (v > TFTP_BLKSIZE_MAX) v = TFTP_BLKSIZE_MAX;
+                sp->blksize = v;
+                options |= OPTION_BLKSIZE;
+            }
+        }
+        else if (strcasecmp(name, "windowsize") == 0) {
+            if (v >= 1) {
+                if (v > TFTP_WINDOWSIZE_MAX) v = TFTP_WINDOWSIZE_MAX;
+                sp->windowsize = v;
+                options |= OPTION_WINDOWSIZE;
+            }
+        }
+    }
+    return options;
+}
+
 /*
  * Filename matcher
  *   Ignore case.
@@ -182,175 +521,282 @@ match(const char *name, const char *table)
 }
 
 /*
- * Handle an incoming packet
+ * Handle a read or write request
+ * Return block number to acknowledge or -1 for none.
  */
-static void
-tftp_recv_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
-                   const ip_addr_t *fromAddr, u16_t fromPort)
+static int
+handleRequest(struct udp_pcb *pcb, struct tftpSession *sp, int opcode,
+              char *cp, int len)
 {
-    unsigned char *cp = p->payload;
-    long addr = htonl(fromAddr->addr);
+    char *name = cp + 2, *mode = NULL;
+    const char *openName = name;
+    int nullCount = 0, i = 2;
+    int options = 0;
     int ackBlock = -1;
-    static u16_t lastBlock;
-    static int lastSend;
     int bytesTrans;
-    static int fileIndex = -1;
     FRESULT fr;
-    static FIL fil, *fp;
-
-    if (debugFlags & DEBUGFLAG_TFTP)
-        printf("%3d on port %d from %d.%d.%d.%d:%d  %02X%02X %02X%02X\n",
-                                                    p->len,
-                                                    pcb->local_port,
-                                                    (int)((addr >> 24) & 0xFF),
-                                                    (int)((addr >> 16) & 0xFF),
-                                                    (int)((addr >>  8) & 0xFF),
-                                                    (int)((addr      ) & 0xFF),
-                                                    fromPort,
-                                                    cp[0], cp[1], cp[2], cp[3]);
-    /*
-     * Ignore runt packets
-     */
-    if (p->len >= 4) {
-        int opcode = (cp[0] << 8) | cp[1];
-        if ((opcode == TFTP_OPCODE_RRQ)
-         || (opcode == TFTP_OPCODE_WRQ)) {
-            char *name = (char *)cp + 2, *mode = NULL;
-            int nullCount = 0, i = 2;
-            lastBlock = 0;
-            fileIndex = -1;
-            while (i < p->len) {
-                if (cp[i++] == '\0') {
-                    nullCount++;
-                    if (nullCount == 1)
-                        mode = (char *)cp + i;
-
-                    if (nullCount == 2) {
-                        int f;
-                        if (debugFlags & DEBUGFLAG_TFTP)
-                            printf("NAME:%s  MODE:%s\n", name, mode);
-
-                        if (strcasecmp(mode, "octet") != 0) {
-                            replyERR(pcb, fromAddr, fromPort, "Bad Type");
-                        }
-                        else {
-                            for (f = 0 ; f < FILE_TABLE_SIZE ; f++) {
-                                if (match(name, fileTable[f].name)) {
-                                    fileIndex = f;
-                                    break;
-                                }
-                            }
-
-                            if (fileIndex < 0) {
-                                replyERR(pcb, fromAddr, fromPort, "Bad Name");
-                                break;
-                            }
-
-                            if (opcode == TFTP_OPCODE_RRQ) {
-                                int (*funcp)(void) = fileTable[fileIndex].preTransmit;
-                                if (funcp) {
-                                    bytesTrans = (*funcp)();
-                                    if (bytesTrans < 0) {
-                                        replyERR(pcb, fromAddr, fromPort, "Error Fetching File");
-                                        break;
-                                    }
-                                }
-                            }
-
-                            if (fp) {
-                                f_close(fp);
-                                fp = NULL;
-                            }
-                            fr = f_open(&fil, name, (opcode==TFTP_OPCODE_RRQ) ?
-                                                   FA_READ :
-                                                   FA_WRITE | FA_CREATE_ALWAYS);
-                            if (fr == FR_OK) {
-                                ackBlock = 0;
-                                fp = &fil;
-                            }
-                            else {
-                                const char *msg = ffsStrerror(fr);
-                                if (debugFlags & DEBUGFLAG_TFTP) {
-                                    printf("\"%s\" -- %s\n", name, msg);
-                                }
-                                replyERR(pcb, fromAddr, fromPort, msg);
-                            }
-                        }
+
+    sp->lastBlock = 0;
+    while (i < len) {
+        if (cp[i++] == '\0') {
+            nullCount++;
+            if (nullCount == 1)
+                mode = cp + i;
+
+            if (nullCount == 2) {
+                int f, fileIndex = -1;
+                if (debugFlags & DEBUGFLAG_TFTP)
+                    printf("NAME:%s  MODE:%s\n", name, mode);
+
+                if (strcasecmp(mode, "octet") != 0) {
+                    replyERR(pcb, &sp->addr, sp->port, "Bad Type");
+                    break;
+                }
+                options = parseOptions(sp, cp + i, len - i);
+                for (f = 0 ; f < FILE_TABLE_SIZE ; f++) {
+                    if (match(name, fileTable[f].name)) {
+                        fileIndex = f;
                         break;
                     }
                 }
-            }
-            if ((ackBlock == 0) && (opcode == TFTP_OPCODE_RRQ)) {
-                ackBlock = -1;
-                lastBlock = 1;
-                lastSend = sendBlock(pcb, fromAddr, fromPort, lastBlock, fp);
-            }
-        }
-        else if (opcode == TFTP_OPCODE_DATA && fileIndex >= 0) {
-            int block = (cp[2] << 8) | cp[3];
-            if (block == lastBlock) {
-                ackBlock = block;
-            }
-            else if (block == (u16_t)(lastBlock + 1)) {
-                int nBytes = p->len - (2 * sizeof(u16_t));
-                lastBlock = block;
-                ackBlock = block;
-                if (nBytes > 0) {
-                    UINT nWritten;
-                    fr = f_write(fp, (char *)(cp+4), nBytes, &nWritten);
-                    if ((fr != FR_OK) || (nWritten != nBytes)) {
-                        ackBlock = -1;
-                        if (debugFlags & DEBUGFLAG_TFTP) {
-                            printf("Write failed %s %d!=%d\n", ffsStrerror(fr),
-                                                         (int)nWritten, nBytes);
+
+                if (fileIndex < 0) {
+                    replyERR(pcb, &sp->addr, sp->port, "Bad Name");
+                    break;
+                }
+                if (fileIsBusy(fileIndex)) {
+                    replyERR(pcb, &sp->addr, sp->port, "File Busy");
+                    break;
+                }
+
+                if (opcode == TFTP_OPCODE_RRQ) {
+                    int (*funcp)(void) = fileTable[fileIndex].preTransmit;
+                    if (funcp) {
+                        bytesTrans = (*funcp)();
+                        if (bytesTrans < 0) {
+                            replyERR(pcb, &sp->addr, sp->port, "Error Fetching File");
+                            break;
                         }
-                        replyERR(pcb, fromAddr, fromPort, ffsStrerror(fr));
                     }
                 }
-                if (fp && (nBytes < 512)) {
-                    fr = f_close(fp);
-                    fp = NULL;
-                    if (fr != FR_OK) {
-                        ackBlock = -1;
-                        if (debugFlags & DEBUGFLAG_TFTP) {
-                            printf("Close failed -- %s\n", ffsStrerror(fr));
-                        }
-                        replyERR(pcb, fromAddr, fromPort, ffsStrerror(fr));
+                else {
+                    const char *(*funcp)(const char *) = fileTable[fileIndex].preReceive;
+                    if (writeBufferOwner) {
+                        replyERR(pcb, &sp->addr, sp->port, "Receive Busy");
+                        break;
                     }
-
-                    bytesTrans = 0;
-                    int (*funcPostReceive)(void) = fileTable[fileIndex].postReceive;
-                    if (funcPostReceive) {
-                        bytesTrans = (*funcPostReceive)();
-                        if (bytesTrans < 0) {
-                            replyERR(pcb, fromAddr, fromPort, "Error Stashing File");
+                    if (funcp) {
+                        openName = (*funcp)(name);
+                        if (openName == NULL) {
+                            replyERR(pcb, &sp->addr, sp->port, "Can't Receive File");
+                            break;
                         }
                     }
+                }
 
-                    void (*funcCommit)(void) = fileTable[fileIndex].commit;
-                    if (funcCommit && bytesTrans > 0) {
-                        (*funcCommit)();
+                fr = f_open(&sp->fil, openName, (opcode==TFTP_OPCODE_RRQ) ?
+                                                FA_READ :
+                                                FA_WRITE | FA_CREATE_ALWAYS);
+                if (fr == FR_OK) {
+                    ackBlock = 0;
+                    sp->fileIndex = fileIndex;
+                    sp->fp = &sp->fil;
+                    sp->isRead = (opcode == TFTP_OPCODE_RRQ);
+                    sp->wbufCount = 0;
+                    if (!sp->isRead) {
+                        writeBufferOwner = sp;
+                        sp->wbuf = writeBuffer;
                     }
-
-                    fileIndex = -1;
+                    sp->blocksSinceAck = 0;
+                    sp->gapAcked = 0;
+                    sp->blocksAcked = 0;
+                    sp->windowCount = 0;
+                    TRACE(DEBUGFLAG_TFTP, TRACE_TFTP_REQUEST, opcode, fileIndex,
+                                                          sp - sessions, 0);
+                }
+                else {
+                    const char *msg = ffsStrerror(fr);
+                    TRACE(DEBUGFLAG_TFTP, TRACE_TFTP_OPEN_FAILED, opcode,
+                                               fileIndex, sp - sessions, fr);
+                    if (opcode == TFTP_OPCODE_WRQ) {
+                        abortReceive(fileIndex);
+                    }
+                    replyERR(pcb, &sp->addr, sp->port, msg);
                 }
+                break;
             }
         }
-        else if (opcode == TFTP_OPCODE_ACK && fileIndex >= 0) {
-            int block = (cp[2] << 8) | cp[3];
-            if (block == lastBlock) {
-                lastBlock++;
-                if (lastSend == 512) {
-                    lastSend = sendBlock(pcb, fromAddr, fromPort, lastBlock, fp);
-                }
-                else {
-                    f_close(fp);
-                    fp = NULL;
-                    fileIndex = -1;
+    }
+    if (ackBlock == 0) {
+        /*
+         * Options are acknowledged by an OACK in place of the
+         * ACK of a write request or the first block of a read request.
+         * A read then starts when the client acknowledges 'block 0'.
+         */
+        if (options) {
+            ackBlock = -1;
+            replyOACK(pcb, sp, options);
+        }
+        else if (opcode == TFTP_OPCODE_RRQ) {
+            ackBlock = -1;
+            if (sendWindow(pcb, sp) < 0) {
+                sessionEnd(sp);
+            }
+        }
+    }
+    else {
+        sessionEnd(sp);
+    }
+    return ackBlock;
+}
+
+/*
+ * Handle a data packet
+ * Return block number to acknowledge or -1 for none.
+ */
+static int
+handleData(struct udp_pcb *pcb, struct tftpSession *sp, char *cp, int len)
+{
+    int block = ((cp[2] & 0xFF) << 8) | (cp[3] & 0xFF);
+    int ackBlock = -1;
+    int bytesTrans;
+    FRESULT fr;
+
+    if (block == (u16_t)(sp->lastBlock + 1)) {
+        int nBytes = len - (2 * sizeof(u16_t));
+        sp->lastBlock = block;
+        sp->gapAcked = 0;
+        if (++sp->blocksSinceAck >= sp->windowsize) {
+            sp->blocksSinceAck = 0;
+            ackBlock = block;
+        }
+        if (nBytes > 0) {
+            void (*funcReceiveData)(const char *, int) = fileTable[sp->fileIndex].receiveData;
+            if (funcReceiveData) {
+                (*funcReceiveData)(cp+4, nBytes);
+            }
+            fr = bufferedWrite(sp, cp+4, nBytes);
+            if (fr != FR_OK) {
+                replyERR(pcb, &sp->addr, sp->port, ffsStrerror(fr));
+                sessionEnd(sp);
+                return -1;
+            }
+        }
+        if (nBytes < sp->blksize) {
+            ackBlock = block;
+            fr = flushWriteBuffer(sp);
+            if (fr == FR_OK) {
+                fr = f_close(sp->fp);
+            }
+            else {
+                f_close(sp->fp);
+            }
+            sp->fp = NULL;
+            if (fr != FR_OK) {
+                ackBlock = -1;
+                TRACE(DEBUGFLAG_TFTP, TRACE_TFTP_CLOSE_FAILED, sp->fileIndex,
+                                                     sp - sessions, fr, 0);
+                replyERR(pcb, &sp->addr, sp->port, ffsStrerror(fr));
+            }
+
+            bytesTrans = 0;
+            int (*funcPostReceive)(void) = fileTable[sp->fileIndex].postReceive;
+            if (funcPostReceive) {
+                bytesTrans = (*funcPostReceive)();
+                if (bytesTrans < 0) {
+                    replyERR(pcb, &sp->addr, sp->port, "Error Stashing File");
                 }
             }
+
+            void (*funcCommit)(void) = fileTable[sp->fileIndex].commit;
+            if (funcCommit && bytesTrans > 0) {
+                (*funcCommit)();
+            }
+
+            TRACE(DEBUGFLAG_TFTP, TRACE_TFTP_COMPLETE, sp->fileIndex, block,
+                                                          sp - sessions, 0);
+            sessionEnd(sp);
+        }
+    }
+    else if ((block == sp->lastBlock) || !sp->gapAcked) {
+        /*
+         * Retransmission or lost block -- have
+         * sender restart following last good block.
+         */
+        sp->gapAcked = 1;
+        sp->blocksSinceAck = 0;
+        ackBlock = sp->lastBlock;
+    }
+    return ackBlock;
+}
+
+/*
+ * Handle an acknowledgement
+ */
+static void
+handleAck(struct udp_pcb *pcb, struct tftpSession *sp, char *cp)
+{
+    int block = ((cp[2] & 0xFF) << 8) | (cp[3] & 0xFF);
+    int delta = (u16_t)(block - (u16_t)sp->blocksAcked);
+
+    /*
+     * Ignore acknowledgements of blocks not yet sent.
+     * Resend the remainder of the window otherwise.
+     */
+    if (delta <= sp->windowCount) {
+        sp->blocksAcked += delta;
+        if ((delta == sp->windowCount)
+         && (sp->windowCount > 0)
+         && (sp->lastSend < sp->blksize)) {
+            TRACE(DEBUGFLAG_TFTP, TRACE_TFTP_COMPLETE, sp->fileIndex,
+                                      sp->blocksAcked, sp - sessions, 0);
+            sessionEnd(sp);
+        }
+        else if (sendWindow(pcb, sp) < 0) {
+            sessionEnd(sp);
+        }
+    }
+}
+
+/*
+ * Handle an incoming packet
+ */
+static void
+tftp_recv_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                   const ip_addr_t *fromAddr, u16_t fromPort)
+{
+    unsigned char *cp = p->payload;
+    int ackBlock = -1;
+    struct tftpSession *sp;
+
+    TRACE(DEBUGFLAG_TFTP, TRACE_TFTP_PACKET, p->len, ntohl(fromAddr->addr),
+                                fromPort, (p->len >= 4) ?
+                                (((uint32_t)cp[0] << 24) | (cp[1] << 16) |
+                                                (cp[2] << 8) | cp[3]) : 0);
+    /*
+     * Ignore runt packets
+     */
+    if (p->len >= 4) {
+        int opcode = (cp[0] << 8) | cp[1];
+        if ((opcode == TFTP_OPCODE_RRQ)
+         || (opcode == TFTP_OPCODE_WRQ)) {
+            sp = sessionNew(fromAddr, fromPort);
+            if (sp == NULL) {
+                replyERR(pcb, fromAddr, fromPort, "Too Many Transfers");
+            }
             else {
-                lastSend = sendBlock(pcb, fromAddr, fromPort, lastBlock, NULL);
+                ackBlock = handleRequest(pcb, sp, opcode, (char *)cp, p->len);
+            }
+        }
+        else if ((sp = sessionFind(fromAddr, fromPort)) != NULL) {
+            if ((opcode == TFTP_OPCODE_DATA) && !sp->isRead) {
+                ackBlock = handleData(pcb, sp, (char *)cp, p->len);
+            }
+            else if ((opcode == TFTP_OPCODE_ACK) && sp->isRead) {
+                handleAck(pcb, sp, (char *)cp);
+            }
+            else if (opcode == TFTP_OPCODE_ERROR) {
+                sessionEnd(sp);
             }
         }
     }
@@ -369,7 +815,9 @@ filesystemReadbacks(void)
 
     for (i = 0 ; i < FILE_TABLE_SIZE ; i++) {
         bytesTrans = 0;
-        int (*funcPostReceive)(void) = fileTable[i].postReceive;
+        int (*funcPostReceive)(void) = fileTable[i].readback ?
+                                                fileTable[i].readback :
+                                                fileTable[i].postReceive;
         if (funcPostReceive) {
             bytesTrans = (*funcPostReceive)();
             if (bytesTrans < 0) {
@@ -5,6 +5,7 @@
 #define _TFTP_H_
 
 void tftpInit(void);
+void tftpCrank(void);
 void filesystemReadbacks(void);
 
 #endif  /* _TFTP_H_ */
@@ -0,0 +1,88 @@
+/*
+ * Binary trace of diagnostic events
+ *
+ * Tracepoints store fixed-size records in a RAM ring rather than
+ * formatting messages, so they can be left enabled without disturbing
+ * the timing of the code being observed.  The ring is read out by TFTP
+ * and decoded off-board using the event descriptions in trace.h.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ffs.h"
+#include "trace.h"
+#include "util.h"
+
+struct traceRecord traceRing[TRACE_CAPACITY];
+uint32_t traceHead;
+int traceFlags = DEBUGFLAG_EPICS | DEBUGFLAG_TFTP | DEBUGFLAG_ACQUISITION |
+                 DEBUGFLAG_CALIBRATION;
+
+/*
+ * Write the ring contents, oldest first
+ */
+int
+traceFetchFile(void)
+{
+    FRESULT fr;
+    FIL fil;
+    UINT nWritten;
+    uint32_t head = traceHead;
+    uint32_t first, n;
+    int total = 0;
+
+    fr = f_open(&fil, "/"TRACE_FILE_NAME, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        return -1;
+    }
+    first = head < TRACE_CAPACITY ? 0 : head - TRACE_CAPACITY;
+    while (first != head) {
+        int i = first % TRACE_CAPACITY;
+        n = head - first;
+        if (n > (TRACE_CAPACITY - i)) n = TRACE_CAPACITY - i;
+        fr = f_write(&fil, &traceRing[i], n * sizeof traceRing[0], &nWritten);
+        if ((fr != FR_OK) || (nWritten != (n * sizeof traceRing[0]))) {
+            total = -1;
+            break;
+        }
+        total += nWritten;
+        first += n;
+    }
+    if (f_close(&fil) != FR_OK) {
+        return -1;
+    }
+    return total;
+}
+
+/*
+ * Console command
+ */
+int
+traceCommand(int argc, char **argv)
+{
+    char *endp;
+    int flags;
+
+    if ((argc > 1) && (strcmp(argv[1], "-c") == 0)) {
+        traceHead = 0;
+        argc--;
+        argv++;
+    }
+    if (argc > 2) {
+        printf("Usage: trace [-c] [flags]\n");
+        return 1;
+    }
+    if (argc == 2) {
+        flags = strtol(argv[1], &endp, 0);
+        if (*endp != '\0') {
+            printf("Bad argument '%s'.\n", argv[1]);
+            return 1;
+        }
+        traceFlags = flags;
+    }
+    printf("Trace flags 0x%X, %u records stored, %d retained.\n",
+                    traceFlags, (unsigned int)traceHead,
+                    traceHead < TRACE_CAPACITY ? (int)traceHead : TRACE_CAPACITY);
+    return 0;
+}
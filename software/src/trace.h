@@ -0,0 +1,101 @@
+/*
+ * Binary trace of diagnostic events
+ */
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "gpio.h"
+
+#define TRACE_FILE_NAME     "TRACE.bin"
+
+/*
+ * Trace records, also available by TFTP as TRACE_FILE_NAME.
+ * Records are little-endian and in order of arrival, oldest first.
+ * The sequence number is the low bits of a count of records ever
+ * stored so gaps show where the ring was overwritten.
+ */
+#define TRACE_ARG_COUNT     4
+struct traceRecord {
+    uint32_t    usSinceBoot;
+    uint16_t    event;
+    uint16_t    sequence;
+    uint32_t    args[TRACE_ARG_COUNT];
+};
+
+/*
+ * Event identifiers and their arguments.
+ * Values are part of the TRACE.bin format -- do not renumber.
+ */
+enum traceEvent {
+    TRACE_NONE                  = 0,
+
+    TRACE_EPICS_PACKET          = 0x100, /* length, IPv4 address, port */
+    TRACE_EPICS_BAD_SIZE        = 0x101, /* length */
+    TRACE_EPICS_COMMAND         = 0x102, /* command, arg count, arg 0, nonce */
+    TRACE_EPICS_REPLY           = 0x103, /* reply size, command */
+    TRACE_EPICS_BAD_MAGIC       = 0x104, /* magic */
+
+    TRACE_ACQ_ARM               = 0x200, /* channel, enable, CSR */
+    TRACE_ACQ_STATUS            = 0x201, /* set, FULL bits, ACTIVE bits */
+    TRACE_ACQ_READOUT           = 0x202, /* channel, trigger channel,
+                                            trigger location */
+    TRACE_ACQ_SEGMENT_MEAN      = 0x203, /* channel, segment, mean (float) */
+    TRACE_ACQ_TRIGGER_CONFIG    = 0x204, /* channel, trigger register */
+    TRACE_ACQ_TRIGGER_LEVEL     = 0x205, /* channel, microvolts, counts */
+    TRACE_ACQ_SOFT_TRIGGER      = 0x206,
+    TRACE_ACQ_COMPLETE          = 0x207, /* microseconds */
+    TRACE_ACQ_CANCEL            = 0x208,
+
+    TRACE_TFTP_REQUEST          = 0x300, /* opcode, file index, session */
+    TRACE_TFTP_COMPLETE         = 0x301, /* file index, blocks, session */
+    TRACE_TFTP_TIMEOUT          = 0x302, /* session */
+    TRACE_TFTP_PACKET           = 0x303, /* length, IPv4 address, port,
+                                            opcode and block (big-endian) */
+    TRACE_TFTP_OPEN_FAILED      = 0x304, /* opcode, file index, session,
+                                            FatFs result */
+    TRACE_TFTP_CLOSE_FAILED     = 0x305, /* file index, session,
+                                            FatFs result */
+
+    TRACE_AFE_TRAINING_TONE     = 0x400, /* enable */
+    TRACE_AFE_CALIBRATION       = 0x401, /* channel, gain code,
+                                            ground reading, DAC reading */
+};
+
+/*
+ * Classes of events to be recorded use the DEBUGFLAG_xxx bits.
+ */
+#define TRACE_CAPACITY      8192    /* Must be a power of 2 */
+extern struct traceRecord traceRing[TRACE_CAPACITY];
+extern uint32_t traceHead;          /* Count of records ever stored */
+extern int traceFlags;
+
+/*
+ * A handful of stores when the class is enabled, a test and branch when not.
+ */
+#define TRACE(flag, id, a0, a1, a2, a3) do {                                 \
+    if (traceFlags & (flag)) {                                               \
+        struct traceRecord *_trp = &traceRing[traceHead & (TRACE_CAPACITY-1)];\
+        _trp->usSinceBoot = MICROSECONDS_SINCE_BOOT();                       \
+        _trp->event = (id);                                                  \
+        _trp->sequence = traceHead++;                                        \
+        _trp->args[0] = (a0);                                                \
+        _trp->args[1] = (a1);                                                \
+        _trp->args[2] = (a2);                                                \
+        _trp->args[3] = (a3);                                                \
+    }                                                                        \
+} while (0)
+
+static inline uint32_t
+traceFloat(float f)
+{
+    uint32_t v;
+    memcpy(&v, &f, sizeof v);
+    return v;
+}
+
+int traceCommand(int argc, char **argv);
+int traceFetchFile(void);
+
+#endif  /* _TRACE_H_ */
@@ -26,6 +26,7 @@ fatal(const char *fmt, ...)
     va_end(args);
     displayShowFatal(cbuf);
     printf("*** Fatal error: %s\n", cbuf);
+    consoleFlush();
     while ((GPIO_READ(GPIO_IDX_SECONDS_SINCE_BOOT) - then) < 60) {
         displayUpdate();
         checkForReset();
@@ -70,6 +71,7 @@ showReg(unsigned int i)
 void
 resetFPGA(void)
 {
+    consoleFlush();
     st7789vBacklightEnable(0);
     st7789vFlood(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT, 0);
     st7789vAwaitCompletion();
@@ -48,6 +48,14 @@
 #define IIC_INDEX_SFP_0_INFO             39
 #define IIC_INDEX_SFP_0_STATUS           40
 
+/*
+ * Board EEPROM
+ * Keep clear of the board information at the start of the device.
+ */
+#define EEPROM_CAPACITY                     1024
+#define EEPROM_PAGE_SIZE                    16
+#define EEPROM_SYSTEM_PARAMETERS_ADDRESS    0x300
+
 #define SPI_MUX_2594_A_ADC    0
 #define SPI_MUX_2594_B_ADC    1
 #define SPI_MUX_04208         2
@@ -72,6 +80,8 @@ uint32_t lmk04208read(int reg);
 int lmk04208write(uint32_t value);
 int lmx2594read(int muxSelect, int reg);
 int lmx2594write(int muxSelect, uint32_t value);
+int lmx2594writeStream(int muxSelect, const uint32_t *values, int n);
+int lmx2594readStream(int muxSelect, uint32_t *values, int n);
 
 int sfpGetStatus(uint32_t *buf);
 int sfpGetTemperature(void);
@@ -6,6 +6,7 @@
  */
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <xiicps.h>
 #include "iic.h"
 #include "util.h"
@@ -238,6 +239,37 @@ iicRecv(struct controller *cp, int address, uint8_t *buf, int n)
     return status == XST_SUCCESS;
 }
 
+/*
+ * Stream a sequence of transfers through the I2C/SPI adapter.
+ * The I2C multiplexer is set once and the usual per-transaction
+ * settling time is replaced by a wait just long enough for the
+ * adapter to shift the bytes out.  The adapter does not acknowledge
+ * its address while a transfer is in progress so retry on failure.
+ */
+#define SPI_US_PER_BYTE     70  /* Slowest (115 kHz) adapter SPI clock */
+#define SPI_OVERHEAD_US     50
+#define SPI_SEND_RETRIES    10
+
+static int
+spiStreamSend(struct controller *cp, int address, const uint8_t *buf, int n)
+{
+    int pass = 0;
+
+    while (XIicPs_MasterSendPolled(&cp->Iic, (uint8_t *)buf, n, address)
+                                                            != XST_SUCCESS) {
+        if (++pass >= SPI_SEND_RETRIES) return 0;
+        microsecondSpin(SPI_OVERHEAD_US);
+    }
+    microsecondSpin(((n - 1) * SPI_US_PER_BYTE) + SPI_OVERHEAD_US);
+    return 1;
+}
+
+static int
+spiStreamRecv(struct controller *cp, int address, uint8_t *buf, int n)
+{
+    return XIicPs_MasterRecvPolled(&cp->Iic, buf, n, address) == XST_SUCCESS;
+}
+
 /*
  * Set multiplexers
  */
@@ -378,7 +410,7 @@ iicWrite(unsigned int deviceIndex, const uint8_t *buf, int n)
 
 /*
  * EEPROM I/O
- * writes must not span page boundaries.
+ * Writes are split at page boundaries.
  */
 int
 eepromRead(int address, void *buf, int n)
@@ -403,6 +435,59 @@ eepromRead(int address, void *buf, int n)
     return 1;
 }
 
+/*
+ * Page-at-a-time EEPROM update
+ * Each page is read back first and written only if its contents differ.
+ * Completion of a write is detected by polling for the device to
+ * acknowledge its address rather than waiting out the worst-case write
+ * cycle time.  The Xilinx routines are used directly to avoid the delays
+ * and diagnostic output of iicSend/iicRecv on every poll.
+ */
+#define EEPROM_WRITE_TIMEOUT_US 10000
+#define EEPROM_SEND_RETRIES     20
+
+static int
+eepromAwaitIdle(struct controller *cp, int deviceAddress,
+                uint8_t *addressBuf, int addressCount)
+{
+    uint32_t then = MICROSECONDS_SINCE_BOOT();
+
+    while (XIicPs_MasterSendPolled(&cp->Iic, addressBuf, addressCount,
+                                               deviceAddress) != XST_SUCCESS) {
+        if ((MICROSECONDS_SINCE_BOOT() - then) > EEPROM_WRITE_TIMEOUT_US) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Write one page, or part of one page.
+ * The first addressCount bytes of xBuf hold the address within the device.
+ * Return 1 if written, 0 if unchanged, -1 on failure.
+ */
+static int
+eepromUpdatePage(struct controller *cp, int deviceAddress,
+                 uint8_t *xBuf, int addressCount, const uint8_t *src, int n)
+{
+    uint8_t rBuf[EEPROM_PAGE_SIZE];
+    int passCount = 0;
+
+    if (!eepromAwaitIdle(cp, deviceAddress, xBuf, addressCount)) return -1;
+    if ((XIicPs_MasterRecvPolled(&cp->Iic, rBuf, n, deviceAddress)
+                                                            == XST_SUCCESS)
+     && (memcmp(rBuf, src, n) == 0)) {
+        return 0;
+    }
+    memcpy(xBuf + addressCount, src, n);
+    while (XIicPs_MasterSendPolled(&cp->Iic, xBuf, addressCount + n,
+                                               deviceAddress) != XST_SUCCESS) {
+        if (++passCount > EEPROM_SEND_RETRIES) return -1;
+    }
+    if (!eepromAwaitIdle(cp, deviceAddress, xBuf, addressCount)) return -1;
+    return 1;
+}
+
 int
 eepromWrite(int address, const void *buf, int n)
 {
@@ -411,26 +496,27 @@ eepromWrite(int address, const void *buf, int n)
     uint16_t subAddress = address & 0xFFFF;
     const uint8_t *src = buf;
     int nLeft = n;
+    int pageCount = 0;
 
+    if (subAddress + n > EEPROM_CAPACITY) return 0;
     if (!setMux(cp, dp->muxPort)) return 0;
     while (nLeft) {
-        uint8_t xBuf[66];   /* Two greater than page size, beucase 2-byte addressing */
-        int i = 2;
-        int passCount = 0;
+        uint8_t xBuf[2+EEPROM_PAGE_SIZE];   /* 2-byte addressing */
+        int nPage = EEPROM_PAGE_SIZE - (subAddress % EEPROM_PAGE_SIZE);
+        int status;
+        if (nPage > nLeft) nPage = nLeft;
         xBuf[0] = (subAddress >> 8) & 0xFF; // MSB sent first
         xBuf[1] = subAddress & 0xFF;
-        while (nLeft) {
-            xBuf[i++] = *src++;
-            subAddress++;
-            nLeft--;
-            // write each 64-byte page
-            if ((subAddress & 0x3F) == 0) break;
-        }
-        /* Ensure completion of write operation */
-        while (!iicSend(cp, dp->deviceAddress, xBuf, i)) {
-            if (++passCount > 20) return 0;
-        }
-        microsecondSpin(5000);
+        status = eepromUpdatePage(cp, dp->deviceAddress, xBuf, 2, src, nPage);
+        if (status < 0) return 0;
+        pageCount += status;
+        src += nPage;
+        subAddress += nPage;
+        nLeft -= nPage;
+    }
+    if (debugFlags & DEBUGFLAG_IIC) {
+        printf("eepromWrite %d@%d: %d page%s written\n", n, address,
+                                          pageCount, pageCount == 1 ? "" : "s");
     }
     return 1;
 }
@@ -557,6 +643,59 @@ lmx2594write(int muxSelect, uint32_t value)
     return 1;
 }
 
+/*
+ * Write a sequence of LMX2594 registers
+ */
+int
+lmx2594writeStream(int muxSelect, const uint32_t *values, int n)
+{
+    struct deviceInfo *dp = &deviceTable[IIC_INDEX_I2C2SPI];
+    struct controller *cp = &controllers[dp->controllerIndex];
+    uint8_t iicBuf[4];
+
+    if (muxSelect >= 4) return 0;
+    if (!setMux(cp, dp->muxPort)) return 0;
+    iicBuf[0] = 0x8 >> muxSelect;
+    while (n--) {
+        uint32_t v = *values++;
+        iicBuf[1] = (v >> 16) & 0x7F;
+        iicBuf[2] = v >> 8;
+        iicBuf[3] = v;
+        if (!spiStreamSend(cp, dp->deviceAddress, iicBuf, 4)) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Read a sequence of LMX2594 registers
+ * Register address on entry and (address << 16) | value on return,
+ * the same layout as the values written.
+ */
+int
+lmx2594readStream(int muxSelect, uint32_t *values, int n)
+{
+    struct deviceInfo *dp = &deviceTable[IIC_INDEX_I2C2SPI];
+    struct controller *cp = &controllers[dp->controllerIndex];
+    uint8_t iicBuf[4], rxBuf[3];
+
+    if (muxSelect >= 4) return 0;
+    if (!spiSDOMuxSelect(muxSelect)) return 0;
+    if (!setMux(cp, dp->muxPort)) return 0;
+    iicBuf[0] = 0x8 >> muxSelect;
+    while (n--) {
+        int reg = (*values >> 16) & 0x7F;
+        iicBuf[1] = 0x80 | reg;
+        iicBuf[2] = 0;
+        iicBuf[3] = 0;
+        if (!spiStreamSend(cp, dp->deviceAddress, iicBuf, 4)
+         || !spiStreamRecv(cp, dp->deviceAddress, rxBuf, 3)) {
+            return 0;
+        }
+        *values++ = (reg << 16) | (rxBuf[1] << 8) | rxBuf[2];
+    }
+    return 1;
+}
+
 int
 sfpGetStatus(uint32_t *buf)
 {
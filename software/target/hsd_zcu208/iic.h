@@ -48,6 +48,14 @@
 #define IIC_INDEX_SFP_0_INFO             39
 #define IIC_INDEX_SFP_0_STATUS           40
 
+/*
+ * Board EEPROM
+ * Keep clear of the board information at the start of the device.
+ */
+#define EEPROM_CAPACITY                     16384
+#define EEPROM_PAGE_SIZE                    64
+#define EEPROM_SYSTEM_PARAMETERS_ADDRESS    0x3F00
+
 #define SPI_MUX_2594_A_ADC    0
 #define SPI_MUX_2594_B_DAC    1
 #define SPI_MUX_04828B        2
@@ -71,6 +79,8 @@ uint32_t lmk04828Bread(int reg);
 int lmk04828Bwrite(uint32_t value);
 int lmx2594read(int muxSelect, int reg);
 int lmx2594write(int muxSelect, uint32_t value);
+int lmx2594writeStream(int muxSelect, const uint32_t *values, int n);
+int lmx2594readStream(int muxSelect, uint32_t *values, int n);
 
 int sfpGetStatus(uint32_t *buf);
 int sfpGetTemperature(void);